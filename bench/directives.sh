@@ -0,0 +1,66 @@
+#!/bin/sh
+#
+# Planning time of a 20 table join as the number of directives grows.
+# The directives are on other relations, so this measures what the
+# lookups cost the relations without directives. planfix must be in
+# shared_preload_libraries of the server the libpq environment points
+# to. The database is dropped and created again.
+#
+# usage: bench/directives.sh [database] [seconds]
+
+set -e
+
+DB=${1:-planfix_bench}
+SECONDS_PER_RUN=${2:-10}
+SCRIPT=$(mktemp)
+trap 'rm -f $SCRIPT' EXIT
+
+dropdb --if-exists $DB
+createdb $DB
+psql -q -v ON_ERROR_STOP=1 $DB <<SQL
+CREATE EXTENSION planfix;
+SELECT format('CREATE TABLE t%s (id int PRIMARY KEY, ref int, val int);'
+              'CREATE INDEX ON t%s (ref);'
+              'INSERT INTO t%s SELECT g, g, g FROM generate_series(1, 1000) g',
+              i, i, i)
+  FROM generate_series(1, 20) i \gexec
+ANALYZE;
+SQL
+
+# The other relations are created in batches, one transaction each, as
+# the locks of 10000 tables and their indices do not fit in the lock
+# table of a default configuration.
+BATCH=500
+i=0
+while [ $i -lt 10000 ]; do
+  psql -q -v ON_ERROR_STOP=1 $DB <<SQL
+BEGIN;
+SELECT format('CREATE TABLE f%s (id int PRIMARY KEY)', i)
+  FROM generate_series($((i + 1)), $((i + BATCH))) i \gexec
+COMMIT;
+SQL
+  i=$((i + BATCH))
+done
+
+# EXPLAIN plans the query without running it
+{
+  printf 'EXPLAIN SELECT * FROM t1'
+  i=2
+  while [ $i -le 20 ]; do
+    printf ' JOIN t%d ON t%d.ref = t%d.id' $i $i $((i - 1))
+    i=$((i + 1))
+  done
+  printf ' WHERE t1.val = 42;\n'
+} > $SCRIPT
+
+for n in 0 1 10 100 1000 10000; do
+  if [ $n -eq 0 ]; then
+    value=
+  else
+    value=$(psql -Atq $DB -c "SELECT string_agg(format('f%s,f%s_pkey', i, i), ';') FROM generate_series(1, $n) i")
+  fi
+  psql -q $DB -c "ALTER DATABASE $DB SET planfix.forcedindex = '$value'"
+  printf '%6d directives: ' $n
+  pgbench -n -M simple -T $SECONDS_PER_RUN -f $SCRIPT $DB |
+    sed -n 's/^latency average = //p'
+done
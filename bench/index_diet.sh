@@ -0,0 +1,54 @@
+#!/bin/sh
+#
+# Planning time of a query on a table with 60 indexed columns, with
+# planfix.index_diet off and on. The query references three of the
+# indexed columns, so the diet leaves the planner three of the 61
+# indices to cost. planfix must be in shared_preload_libraries of the
+# server the libpq environment points to. The database is dropped and
+# created again.
+#
+# usage: bench/index_diet.sh [database] [seconds]
+
+set -e
+
+DB=${1:-planfix_bench}
+SECONDS_PER_RUN=${2:-10}
+SCRIPT=$(mktemp)
+trap 'rm -f $SCRIPT' EXIT
+
+dropdb --if-exists $DB
+createdb $DB
+psql -q -v ON_ERROR_STOP=1 $DB <<SQL
+CREATE EXTENSION planfix;
+DO \$\$
+BEGIN
+  EXECUTE 'CREATE TABLE wide (id int PRIMARY KEY, '
+    || (SELECT string_agg(format('c%s int', i), ', ') FROM generate_series(1, 60) i)
+    || ')';
+  EXECUTE 'INSERT INTO wide SELECT g, '
+    || (SELECT string_agg(format('(g * %s) %% 1000', i), ', ') FROM generate_series(1, 60) i)
+    || ' FROM generate_series(1, 100000) g';
+  FOR i IN 1..60 LOOP
+    EXECUTE format('CREATE INDEX ON wide (c%s)', i);
+  END LOOP;
+END
+\$\$;
+ANALYZE wide;
+SQL
+
+# EXPLAIN plans the query without running it
+cat > $SCRIPT <<SQL
+\set v random(0, 999)
+EXPLAIN SELECT * FROM wide WHERE c1 = :v AND c2 > 0 ORDER BY c3 LIMIT 10;
+SQL
+
+# warm up the caches first, so the first measured run does not pay for
+# loading the catalogs
+pgbench -n -M simple -T 1 -f $SCRIPT $DB > /dev/null
+
+for diet in off on; do
+  printf 'index_diet %-3s: ' $diet
+  PGOPTIONS="-c planfix.index_diet=$diet" \
+    pgbench -n -M simple -T $SECONDS_PER_RUN -f $SCRIPT $DB |
+    sed -n 's/^latency average = //p'
+done
@@ -0,0 +1,252 @@
+/* planfix--1.0.sql */
+
+-- complain if script is sourced in psql, rather than via CREATE EXTENSION
+\echo Use "CREATE EXTENSION planfix" to load this file. \quit
+
+-- Shared directives, these need planfix in shared_preload_libraries
+
+CREATE FUNCTION planfix_add_directive(relation regclass,
+				      indexes regclass[],
+				      op text DEFAULT 'forceindex',
+				      queryid bigint DEFAULT 0,
+				      options text DEFAULT '')
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION planfix_remove_directives(relation regclass)
+RETURNS integer
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION planfix_clear_directives()
+RETURNS integer
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+CREATE FUNCTION planfix_directives(OUT relation regclass,
+				   OUT indexes regclass[],
+				   OUT op text,
+				   OUT queryid bigint,
+				   OUT options text)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+REVOKE ALL ON FUNCTION planfix_add_directive(regclass, regclass[], text, bigint, text) FROM PUBLIC;
+REVOKE ALL ON FUNCTION planfix_remove_directives(regclass) FROM PUBLIC;
+REVOKE ALL ON FUNCTION planfix_clear_directives() FROM PUBLIC;
+
+-- Counters of the applied directives and timings, these need planfix
+-- in shared_preload_libraries as well
+
+CREATE FUNCTION planfix_stats(OUT relation regclass,
+			      OUT indexes regclass[],
+			      OUT op text,
+			      OUT queryid bigint,
+			      OUT options text,
+			      OUT matched bigint,
+			      OUT pruned bigint,
+			      OUT time_us bigint,
+			      OUT last_hit timestamptz)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION planfix_stats_reset()
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+REVOKE ALL ON FUNCTION planfix_stats_reset() FROM PUBLIC;
+
+CREATE FUNCTION planfix_timing(OUT kind text,
+			       OUT lower_us bigint,
+			       OUT upper_us bigint,
+			       OUT statements bigint)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION planfix_timing_totals(OUT kind text,
+				      OUT statements bigint,
+				      OUT total_us bigint)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION planfix_timing_reset()
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+REVOKE ALL ON FUNCTION planfix_timing_reset() FROM PUBLIC;
+
+-- Persistent directives, loaded by every backend on first use
+
+CREATE TABLE planfix_directive (
+	relation regclass NOT NULL,
+	indexes regclass[] NOT NULL DEFAULT '{}'
+		CHECK (cardinality(indexes) <= 32),
+	op text NOT NULL DEFAULT 'forceindex'
+		CHECK (op IN ('forceindex', 'disableindex', 'preferindex',
+			      'nestloop', 'hashjoin', 'mergejoin', 'leading',
+			      'rows', 'seqscan', 'indexscan', 'indexonlyscan',
+			      'bitmapscan', 'parallelworkers')),
+	queryid bigint,
+	options text,
+	enabled boolean NOT NULL DEFAULT true
+);
+
+CREATE FUNCTION planfix_directive_changed()
+RETURNS trigger
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+CREATE TRIGGER planfix_directive_changed
+	AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON planfix_directive
+	FOR EACH STATEMENT EXECUTE PROCEDURE planfix_directive_changed();
+
+SELECT pg_catalog.pg_extension_config_dump('planfix_directive', '');
+
+-- Frozen statistics, served to the planner instead of pg_statistic
+
+CREATE TABLE planfix_frozen_stats (
+	starelid regclass NOT NULL,
+	staattnum int2 NOT NULL,
+	stainherit boolean NOT NULL,
+	statistic bytea NOT NULL,
+	PRIMARY KEY (starelid, staattnum, stainherit)
+);
+
+CREATE TRIGGER planfix_frozen_stats_changed
+	AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON planfix_frozen_stats
+	FOR EACH STATEMENT EXECUTE PROCEDURE planfix_directive_changed();
+
+SELECT pg_catalog.pg_extension_config_dump('planfix_frozen_stats', '');
+
+-- Frozen sizes of relations and indices, used instead of pg_class
+
+CREATE TABLE planfix_frozen_class (
+	relation regclass PRIMARY KEY,
+	relpages integer NOT NULL,
+	reltuples real NOT NULL,
+	relallvisible integer
+);
+
+CREATE TRIGGER planfix_frozen_class_changed
+	AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON planfix_frozen_class
+	FOR EACH STATEMENT EXECUTE PROCEDURE planfix_directive_changed();
+
+SELECT pg_catalog.pg_extension_config_dump('planfix_frozen_class', '');
+
+CREATE FUNCTION planfix_statistic(relation regclass,
+				  OUT staattnum int2,
+				  OUT stainherit boolean,
+				  OUT statistic bytea)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION planfix_freeze_stats(relation regclass)
+RETURNS integer
+AS $$
+	DELETE FROM @extschema@.planfix_frozen_stats
+	 WHERE starelid = $1
+	    OR starelid IN (SELECT indexrelid FROM pg_catalog.pg_index
+			     WHERE indrelid = $1);
+	WITH frozen AS (
+		INSERT INTO @extschema@.planfix_frozen_stats
+		SELECT r.oid, s.staattnum, s.stainherit, s.statistic
+		  FROM (SELECT $1::oid AS oid
+			UNION ALL
+			SELECT indexrelid FROM pg_catalog.pg_index
+			 WHERE indrelid = $1) r,
+		       @extschema@.planfix_statistic(r.oid::regclass) s
+		RETURNING 1)
+	SELECT count(*)::integer FROM frozen;
+$$
+LANGUAGE sql STRICT;
+
+CREATE FUNCTION planfix_unfreeze_stats(relation regclass)
+RETURNS integer
+AS $$
+	WITH thawed AS (
+		DELETE FROM @extschema@.planfix_frozen_stats
+		 WHERE starelid = $1
+		    OR starelid IN (SELECT indexrelid FROM pg_catalog.pg_index
+				     WHERE indrelid = $1)
+		RETURNING 1),
+	     sized AS (
+		DELETE FROM @extschema@.planfix_frozen_class
+		 WHERE relation = $1
+		    OR relation IN (SELECT indexrelid FROM pg_catalog.pg_index
+				     WHERE indrelid = $1)
+		RETURNING 1)
+	SELECT ((SELECT count(*) FROM thawed) +
+		(SELECT count(*) FROM sized))::integer;
+$$
+LANGUAGE sql STRICT;
+
+REVOKE ALL ON FUNCTION planfix_statistic(regclass) FROM PUBLIC;
+REVOKE ALL ON FUNCTION planfix_freeze_stats(regclass) FROM PUBLIC;
+REVOKE ALL ON FUNCTION planfix_unfreeze_stats(regclass) FROM PUBLIC;
+
+-- Statistics files, to plan like another cluster
+
+CREATE FUNCTION planfix_export_stats(filename text, relations regclass[])
+RETURNS integer
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION planfix_read_stats(filename text,
+				   OUT relation text,
+				   OUT relpages integer,
+				   OUT reltuples real,
+				   OUT relallvisible integer,
+				   OUT staattnum int2,
+				   OUT attname text,
+				   OUT atttypid oid,
+				   OUT stainherit boolean,
+				   OUT statistic bytea)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+-- Statistics are matched to the local columns by name and skipped if the
+-- type of the column differs
+
+CREATE FUNCTION planfix_import_stats(filename text)
+RETURNS integer
+AS $$
+	WITH r AS (
+		SELECT pg_catalog.to_regclass(relation) AS rel, relpages,
+		       reltuples, relallvisible, attname, atttypid, stainherit,
+		       statistic
+		  FROM @extschema@.planfix_read_stats($1)),
+	     c AS (
+		INSERT INTO @extschema@.planfix_frozen_class
+		SELECT rel, relpages, reltuples, relallvisible
+		  FROM r WHERE rel IS NOT NULL AND statistic IS NULL
+		ON CONFLICT (relation) DO UPDATE
+		   SET relpages = EXCLUDED.relpages,
+		       reltuples = EXCLUDED.reltuples,
+		       relallvisible = EXCLUDED.relallvisible
+		RETURNING 1),
+	     s AS (
+		INSERT INTO @extschema@.planfix_frozen_stats
+		SELECT r.rel, a.attnum, r.stainherit, r.statistic
+		  FROM r JOIN pg_catalog.pg_attribute a
+		    ON a.attrelid = r.rel AND a.attname = r.attname::name
+		   AND a.atttypid = r.atttypid AND NOT a.attisdropped
+		 WHERE r.statistic IS NOT NULL
+		ON CONFLICT (starelid, staattnum, stainherit) DO UPDATE
+		   SET statistic = EXCLUDED.statistic
+		RETURNING 1)
+	SELECT ((SELECT count(*) FROM c) + (SELECT count(*) FROM s))::integer;
+$$
+LANGUAGE sql STRICT;
+
+REVOKE ALL ON FUNCTION planfix_export_stats(text, regclass[]) FROM PUBLIC;
+REVOKE ALL ON FUNCTION planfix_read_stats(text) FROM PUBLIC;
+REVOKE ALL ON FUNCTION planfix_import_stats(text) FROM PUBLIC;
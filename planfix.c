@@ -53,13 +53,15 @@ Technically this extension works by parsing out a list of
 
 PlanfixDirectives
 
-which are kept in a globally allocated list of directives with the 
-quite boring name "directives".
+which are kept in a set of directives, indexed by the oid of their
+relation. Parsed sets are cached per backend, keyed by the setting,
+so repeating a setting does not resolve the names again.
 
-Upon planing a query the list is checked and the index is forced.
+Upon planing a query the set is checked and the index is forced.
 
 Plantuner by Teodor Sigaev does similar things, but it maintains
-a blacklist of indices, rather than a whitelist like planfix.
+a blacklist of indices, rather than a whitelist like planfix. A
+blacklist is available as planfix.disabledindex as well.
 Also plantuner would not work with the table-names i have, which
 are mixed case and need to be quoted.
 
@@ -69,17 +71,58 @@ are mixed case and need to be quoted.
 
 #include <utils/guc.h>
 #include <optimizer/plancat.h>
+#include <optimizer/planner.h>
+#include <optimizer/paths.h>
+#include <optimizer/pathnode.h>
+#include <optimizer/cost.h>
+#include <optimizer/geqo.h>
+#include <optimizer/var.h>
+#include <optimizer/tlist.h>
+#include <nodes/nodeFuncs.h>
 #include <access/heapam.h>
+#include <access/hash.h>
+#include <access/xact.h>
+#include <access/parallel.h>
+#include <access/htup_details.h>
+#include <access/genam.h>
 
 #include <utils/rel.h>
 #include <utils/lsyscache.h>
 #include <utils/builtins.h>
 #include <utils/memutils.h>
+#include <utils/resowner.h>
+#include <utils/hsearch.h>
+#include <lib/stringinfo.h>
 #include <nodes/primnodes.h>
 #include <nodes/print.h>
+#include <utils/inval.h>
+#include <utils/syscache.h>
+#include <utils/fmgroids.h>
 #include <catalog/namespace.h>
+#include <catalog/index.h>
+#include <catalog/pg_type.h>
+#include <catalog/pg_extension.h>
+#include <catalog/indexing.h>
+#include <catalog/pg_statistic.h>
+#include <catalog/pg_class.h>
+#include <storage/fd.h>
+#include <utils/selfuncs.h>
+#include <storage/ipc.h>
+#include <storage/lwlock.h>
+#include <storage/shmem.h>
+#include <port/atomics.h>
+#include <utils/array.h>
+#include <funcapi.h>
+#include <commands/trigger.h>
+#include <commands/explain.h>
+#include <utils/snapmgr.h>
+#include <miscadmin.h>
+#include <tcop/tcopprot.h>
+#include <executor/executor.h>
+#include <portability/instr_time.h>
 
 #include <stdio.h>
+#include <ctype.h>
 
 PG_MODULE_MAGIC;
 
@@ -91,241 +134,4480 @@ void SimpleStringSplit(char *s, char separator, List **tokenList);
  * Global variables for planfix
  */
 
-/* the hook pointer */
+/* the hook pointers */
 static get_relation_info_hook_type oldHook = NULL;
+static planner_hook_type oldPlannerHook = NULL;
+static set_rel_pathlist_hook_type oldPathlistHook = NULL;
+static set_join_pathlist_hook_type oldJoinPathlistHook = NULL;
+static join_search_hook_type oldJoinSearchHook = NULL;
+static ExecutorRun_hook_type oldExecutorRunHook = NULL;
+static get_relation_stats_hook_type oldRelationStatsHook = NULL;
+static get_index_stats_hook_type oldIndexStatsHook = NULL;
+static ExplainOneQuery_hook_type oldExplainOneQueryHook = NULL;
+
+/* queryid of the query being planned, 0 if unknown */
+static uint64 currentQueryId = 0;
+
+/*
+ * Join rels of the query being planned a join directive applied to, by
+ * their planner and relids, so the directives are counted once per
+ * join rel and not for every pair of rels it is joined from, and the
+ * estimate they were given by a rows directive. GEQO builds the join
+ * rels in a memory context of its own for every evaluation, so no
+ * pointers to them are kept, the entries live in the planner's context.
+ */
+typedef struct PlanfixJoinRel_ {
+  PlannerInfo *root;
+  Relids relids;
+  double rows;			/* estimate after the adjustment, or -1 */
+} PlanfixJoinRel;
+
+static List *joinRels = NIL;
+
+/* a query is planned for EXPLAIN, pruned indices are recorded */
+static bool explainActive = false;
+static List *explainPruned = NIL;
 
 /* our memory-context */
 static MemoryContext mc;
 
 
-/* Structure and storage for the directives */
-#define PLANFIX_MAX_DIRECTIVES 200
+/* Structure and storage for the directives */
+#define PLANFIX_MAX_DIRECTIVES 200
+
+/* number of parsed planfix.forcedindex values kept per backend */
+#define PLANFIX_CACHE_SIZE 16
+
+/* maximum number of indices of a shared directive */
+#define PLANFIX_MAX_INDICES 32
+
+/* slots of directive counters in shared memory, a power of 2 */
+#define PLANFIX_MAX_COUNTERS 1024
+
+/* slots probed for the counters of a directive */
+#define PLANFIX_COUNTER_PROBES 16
+
+/*
+ * Buckets of the timing histograms, log-linear over microseconds: four
+ * buckets per power of 2, up to 2^32 microseconds.
+ */
+#define PLANFIX_TIMING_SUBBUCKETS 4
+#define PLANFIX_TIMING_BUCKETS (31 * PLANFIX_TIMING_SUBBUCKETS)
+
+/* maximum workers= of a directive, as for the parallel_workers reloption */
+#define PLANFIX_MAX_WORKERS 1024
+
+typedef enum PlanfixOp_ {
+  PLANFIX_OP_FORCEINDEX,	/* keep only the named indices */
+  PLANFIX_OP_DISABLEINDEX,	/* remove the named indices */
+  PLANFIX_OP_PREFERINDEX,	/* penalize paths not using the indices */
+  PLANFIX_OP_NESTLOOP,		/* join the relations by a nested loop */
+  PLANFIX_OP_HASHJOIN,		/* join the relations by a hash join */
+  PLANFIX_OP_MERGEJOIN,		/* join the relations by a merge join */
+  PLANFIX_OP_LEADING,		/* join the relations first, in this order */
+  PLANFIX_OP_ROWS,		/* override the row estimate */
+  PLANFIX_OP_SEQSCAN,		/* scan the relation sequentially */
+  PLANFIX_OP_INDEXSCAN,		/* scan the relation by an index scan */
+  PLANFIX_OP_INDEXONLYSCAN,	/* scan the relation by an index only scan */
+  PLANFIX_OP_BITMAPSCAN,	/* scan the relation by a bitmap scan */
+  PLANFIX_OP_PARALLELWORKERS,	/* set the parallel workers of the relation */
+  PLANFIX_OP_SET,		/* set parameters for queries on the relations */
+  PLANFIX_NUM_OPS		/* must be last */
+} PlanfixOp;
+
+/* names of the ops as used by the SQL functions, indexed by op */
+static const char *const planfixOpNames[] = {
+  "forceindex",
+  "disableindex",
+  "preferindex",
+  "nestloop",
+  "hashjoin",
+  "mergejoin",
+  "leading",
+  "rows",
+  "seqscan",
+  "indexscan",
+  "indexonlyscan",
+  "bitmapscan",
+  "parallelworkers",
+  "set"
+};
+
+#define planfix_op_is_scan(op) \
+  ((op) >= PLANFIX_OP_SEQSCAN && (op) <= PLANFIX_OP_BITMAPSCAN)
+
+#define planfix_op_is_join(op) \
+  ((op) == PLANFIX_OP_NESTLOOP || (op) == PLANFIX_OP_HASHJOIN || \
+   (op) == PLANFIX_OP_MERGEJOIN)
+
+/* these ops need at least two relations */
+#define planfix_op_needs_join(op) \
+  (planfix_op_is_join(op) || (op) == PLANFIX_OP_LEADING)
+
+/* these ops name further relations instead of indices */
+#define planfix_op_names_relations(op) \
+  (planfix_op_needs_join(op) || (op) == PLANFIX_OP_ROWS || \
+   (op) == PLANFIX_OP_SET)
+
+/* the further names of set with a = are parameter settings */
+#define directive_name_is_setting(op, name) \
+  ((op) == PLANFIX_OP_SET && strchr((name), '=') != NULL)
+
+/* the further relations of leading keep their order */
+#define planfix_op_is_ordered(op) ((op) == PLANFIX_OP_LEADING)
+
+
+/*
+ * The options of a directive, the conditions under which it applies
+ * and the values of its op. A 0 means not given.
+ */
+typedef struct PlanfixOptions_ {
+  uint64 queryId;		/* only for this query */
+  int64 limitMin;		/* only if the LIMIT is at least this */
+  int64 limitBelow;		/* only if the LIMIT is below this */
+  char operName[NAMEDATALEN];	/* only if a qual of the relation uses it */
+  double rows;			/* rows, the estimate */
+  double rowsFactor;		/* rows, multiplies the estimate */
+  double rowsMin;		/* rows, lower bound of the estimate */
+  double rowsMax;		/* rows, upper bound of the estimate */
+  bool workersGiven;		/* parallelworkers, workers is given */
+  int workers;			/* parallelworkers, the number of workers */
+  bool execute;			/* set, also while executing */
+} PlanfixOptions;
+
+/*
+ * A directive names its relation and indices, or for a join the
+ * relation and the other relations of the join. The names are kept
+ * so the directive can be resolved outside of the check hook. The
+ * resolved indices are a sorted array of oids without duplicates,
+ * so membership is a binary search. For leading they are the other
+ * relations in the order given.
+ */
+typedef struct PlanfixDirectives_ {
+  PlanfixOp op;
+  Oid relation;			/* InvalidOid if not resolved */
+  PlanfixOptions opts;
+  int nindices;			/* number of resolved indices */
+  int indices;			/* offset of the index oids in the set */
+  int nnames;			/* number of names, the relation first */
+  int names;			/* offset of the 0 terminated names in the set */
+  int next;			/* next directive of the same relation or -1 */
+  int counter;			/* slot of its counters plus 1, 0 if unknown,
+				 * -1 if it has none */
+} PlanfixDirective;
+
+/*
+ * The directives of one planfix.forcedindex value, as one flat block
+ * of memory without pointers. The block is the GUC extra of the
+ * setting, so restoring a value on abort, at function exit or for
+ * SET LOCAL only installs the pointer again.
+ *
+ * The directives are followed by an open addressing hash of relation
+ * oids (each slot holds the first directive of a relation or -1), the
+ * sorted oids of all referenced relations and indices, the index oids
+ * and the names.
+ *
+ * When relations or indices referenced by the active set change, the
+ * set is resolved again from the names on its next use, so a rebuilt
+ * index is picked up without setting the value again.
+ */
+typedef struct PlanfixDirectiveSet_ {
+  Size size;			/* size of the whole block */
+  uint32 validated;		/* invalidationCount at resolve time, 0 never */
+  int ndirectives;
+  int nunresolved;		/* directives whose names did not resolve */
+  int nslots;			/* hash slots, a power of 2 */
+  int slots;			/* offset of the hash slots */
+  int nrefs;			/* number of referenced oids */
+  int refs;			/* offset of the referenced oids */
+  int nsettings;		/* set directives */
+  int nexecute;			/* set directives with scope=execute */
+  PlanfixDirective directives[FLEXIBLE_ARRAY_MEMBER];
+} PlanfixDirectiveSet;
+
+#define SET_PTR(set, offset) ((char *) (set) + (offset))
+#define directive_indices(set, d) ((Oid *) SET_PTR(set, (d)->indices))
+#define directive_next(set, d) \
+  ((d)->next >= 0 ? &(set)->directives[(d)->next] : NULL)
+
+/*
+ * Cache of resolved sets keyed by the normalized value, the search_path
+ * and the user, most recently used first.
+ */
+typedef struct PlanfixCacheEntry_ {
+  char *key;
+  PlanfixDirectiveSet *set;
+} PlanfixCacheEntry;
+
+static List *directiveCache = NULL;
+
+/*
+ * The sets currently in effect by op, the extras of planfix.forcedindex,
+ * planfix.disabledindex, planfix.preferredindex and of the join method
+ * settings.
+ */
+static PlanfixDirectiveSet *sessionSets[PLANFIX_NUM_OPS];
+
+/* the set of the inline hints of the query being planned */
+static PlanfixDirectiveSet *hintSet = NULL;
+
+/* a directive in shared memory, see planfix_add_directive */
+typedef struct PlanfixSharedDirective_ {
+  Oid database;
+  PlanfixOp op;
+  Oid relation;
+  PlanfixOptions opts;
+  int nindices;
+  Oid indices[PLANFIX_MAX_INDICES];	/* sorted, without duplicates */
+} PlanfixSharedDirective;
+
+/*
+ * The counters of a directive, keyed by the directive as it would be
+ * stored by planfix_add_directive. A slot is taken under the lock and
+ * then never given up again, the counters are atomic.
+ */
+typedef struct PlanfixCounter_ {
+  pg_atomic_uint32 used;	/* key is set */
+  PlanfixSharedDirective key;
+  pg_atomic_uint64 matched;	/* times the directive was applied */
+  pg_atomic_uint64 pruned;	/* indices removed by it */
+  pg_atomic_uint64 micros;	/* time of the hooks applying it */
+  pg_atomic_uint64 lastHit;	/* start of the last statement using it */
+} PlanfixCounter;
+
+/* the kinds of timings */
+typedef enum PlanfixTiming_ {
+  PLANFIX_TIMING_PLANFIX,	/* time in planfix while planning a statement */
+  PLANFIX_TIMING_PLANNING,	/* planning time of a statement */
+  PLANFIX_NUM_TIMINGS
+} PlanfixTiming;
+
+static const char *const planfixTimingNames[] = {
+  "planfix",
+  "planning"
+};
+
+typedef struct PlanfixHistogram_ {
+  pg_atomic_uint64 statements;
+  pg_atomic_uint64 micros;	/* sum of the timings */
+  pg_atomic_uint64 buckets[PLANFIX_TIMING_BUCKETS];
+} PlanfixHistogram;
+
+typedef struct PlanfixShared_ {
+  LWLock *lock;			/* protects the directives */
+  pg_atomic_uint32 generation;	/* bumped on every change */
+  int ndirectives;
+  PlanfixSharedDirective directives[PLANFIX_MAX_DIRECTIVES];
+  PlanfixCounter counters[PLANFIX_MAX_COUNTERS];
+  PlanfixHistogram timings[PLANFIX_NUM_TIMINGS];
+} PlanfixShared;
+
+/* NULL unless loaded through shared_preload_libraries */
+static PlanfixShared *shared = NULL;
+static shmem_startup_hook_type oldShmemStartupHook = NULL;
+
+/* local set of the shared directives of this database */
+static PlanfixDirectiveSet *sharedSet = NULL;
+static uint32 sharedGeneration = 0;
+
+/* local set of the directives of the planfix_directive table */
+static PlanfixDirectiveSet *tableSet = NULL;
+static Oid tableOid = InvalidOid;	/* InvalidOid if not installed */
+static bool tableStale = true;		/* load on the next use */
+
+/*
+ * local copies of the planfix_frozen_stats and planfix_frozen_class
+ * tables, NULL if empty
+ */
+static HTAB *frozenStats = NULL;
+static HTAB *frozenClass = NULL;
+static Oid frozenOid = InvalidOid;	/* InvalidOid if not installed */
+static Oid frozenClassOid = InvalidOid;
+static bool frozenStale = true;		/* load both on the next use */
+static uint32 frozenChecks = 1;		/* counts relcache invalidations */
+
+/*
+ * Bumped by the invalidation callbacks whenever something the active
+ * or a cached set depends on changes, sets validated at an older count
+ * are resolved again before use.
+ */
+static uint32 invalidationCount = 1;
+
+/* a set is being resolved, its refs are not reliable */
+static bool resolving = false;
+
+
+/* current values for configuration guc-variables */
+static char *varForcedIndex = "";
+static char *varDisabledIndex = "";
+static char *varPreferredIndex = "";
+static char *varNestLoop = "";
+static char *varHashJoin = "";
+static char *varMergeJoin = "";
+static char *varLeading = "";
+static char *varRows = "";
+static char *varSeqScan = "";
+static char *varIndexScan = "";
+static char *varIndexOnlyScan = "";
+static char *varBitmapScan = "";
+static char *varParallelWorkers = "";
+static char *varSet = "";
+static double varPreferPenalty = 100.0;
+static bool varIndexDiet = false;
+static bool varTrackTiming = false;
+
+/* planfix utils */
+
+static int oid_cmp(const void *a, const void *b)
+{
+  Oid oa = *(const Oid *) a;
+  Oid ob = *(const Oid *) b;
+  if (oa < ob)
+    return -1;
+  return oa > ob ? 1 : 0;
+}
+
+/* sort oids in place and remove duplicates, returns the new count */
+static int oids_sort_unique(Oid *oids, int n)
+{
+  int i, m;
+  if (n <= 1)
+    return n;
+  qsort(oids, n, sizeof(Oid), oid_cmp);
+  m = 1;
+  for (i = 1; i < n; i++) {
+    if (oids[i] != oids[m - 1])
+      oids[m++] = oids[i];
+  }
+  return m;
+}
+
+/* sort the oids of a directive, unless their order matters */
+static int directive_oids_normalize(PlanfixOp op, Oid *oids, int n)
+{
+  if (planfix_op_is_ordered(op))
+    return n;
+  return oids_sort_unique(oids, n);
+}
+
+/* binary search in a sorted oid array */
+static bool oids_contain(const Oid *oids, int n, Oid oid)
+{
+  int lo = 0, hi = n - 1;
+  while (lo <= hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (oids[mid] == oid)
+      return true;
+    else if (oids[mid] < oid)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  return false;
+}
+
+static bool directive_has_index(PlanfixDirectiveSet *set, PlanfixDirective* d,
+				Oid index)
+{
+  return oids_contain(directive_indices(set, d), d->nindices, index);
+}
+
+static inline int oid_slot(Oid oid, int nslots)
+{
+  return DatumGetUInt32(hash_uint32((uint32) oid)) & (nslots - 1);
+}
+
+/* (re)build the relation hash and the chains of a set */
+static void directive_set_build_slots(PlanfixDirectiveSet *set)
+{
+  int *slots = (int *) SET_PTR(set, set->slots);
+  int i;
+
+  for (i = 0; i < set->nslots; i++)
+    slots[i] = -1;
+  set->nsettings = 0;
+  set->nexecute = 0;
+  for (i = 0; i < set->ndirectives; i++) {
+    PlanfixDirective *d = &set->directives[i];
+    int h;
+
+    d->next = -1;
+    if (d->op == PLANFIX_OP_SET) {
+      set->nsettings++;
+      if (d->opts.execute)
+	set->nexecute++;
+    }
+    if (d->relation == InvalidOid)
+      continue;
+    for (h = oid_slot(d->relation, set->nslots); slots[h] >= 0;
+	 h = (h + 1) & (set->nslots - 1)) {
+      if (set->directives[slots[h]].relation == d->relation)
+	break;
+    }
+    if (slots[h] < 0) {
+      slots[h] = i;
+    } else {
+      PlanfixDirective *tail = &set->directives[slots[h]];
+      while (tail->next >= 0)
+	tail = &set->directives[tail->next];
+      tail->next = i;
+    }
+  }
+}
+
+/* first directive for relid, follow the chain with directive_next */
+static PlanfixDirective* directive_set_lookup(PlanfixDirectiveSet *set,
+					      Oid relid)
+{
+  int *slots;
+  int h;
+
+  if (set == NULL || set->ndirectives == 0)
+    return NULL;
+  slots = (int *) SET_PTR(set, set->slots);
+  for (h = oid_slot(relid, set->nslots); slots[h] >= 0;
+       h = (h + 1) & (set->nslots - 1)) {
+    if (set->directives[slots[h]].relation == relid)
+      return &set->directives[slots[h]];
+  }
+  return NULL;
+}
+
+/* does the set reference the relation or index relid */
+static bool directive_set_references(PlanfixDirectiveSet *set, Oid relid)
+{
+  return oids_contain((Oid *) SET_PTR(set, set->refs), set->nrefs, relid);
+}
+
+#ifdef PLANFIX_DEBUG
+static void directive_print(PlanfixDirectiveSet *set, PlanfixDirective* d) 
+{
+  Oid *indices = directive_indices(set, d);
+  int i;
+  printf(">> PlanfixDirective op=%d, relation=%u\n", d->op, d->relation);
+  for (i = 0; i < d->nindices; i++) {
+    printf(">>   index=%u\n", indices[i]);
+  }
+}
+#endif /* PLANFIX_DEBUG */
+
+
+/* the op named by the first len bytes of name, -1 if there is none */
+static int planfix_op_lookup(const char *name, int len)
+{
+  int i;
+  for (i = 0; i < lengthof(planfixOpNames); i++) {
+    if (strlen(planfixOpNames[i]) == len &&
+	pg_strncasecmp(name, planfixOpNames[i], len) == 0)
+      return i;
+  }
+  return -1;
+}
+
+static PlanfixOp planfix_op_from_name(const char *name)
+{
+  int op = planfix_op_lookup(name, strlen(name));
+  if (op >= 0)
+    return (PlanfixOp) op;
+  ereport(ERROR,
+	  (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+	   errmsg("planfix: unknown op \"%s\"", name)));
+  return PLANFIX_OP_FORCEINDEX;	/* keep compiler quiet */
+}
+
+/*
+ * Allocate an empty set for ndirectives directives with noids index
+ * oids and namelen bytes of names in total, palloc'd in the current
+ * memory-context. Returns the offsets where the index oids and the
+ * names start.
+ */
+static PlanfixDirectiveSet* directive_set_alloc(int ndirectives, int noids,
+						Size namelen, Size *oidsoff,
+						Size *namesoff)
+{
+  PlanfixDirectiveSet *set;
+  int nslots = 8;
+  Size size, refsoff;
+
+  while (nslots < 2 * ndirectives)
+    nslots <<= 1;
+
+  refsoff = offsetof(PlanfixDirectiveSet, directives)
+    + ndirectives * sizeof(PlanfixDirective) + nslots * sizeof(int);
+  *oidsoff = refsoff + (ndirectives + noids) * sizeof(Oid);
+  *namesoff = *oidsoff + noids * sizeof(Oid);
+  size = *namesoff + namelen;
+
+  set = palloc0(size);
+  set->size = size;
+  set->validated = 0;
+  set->ndirectives = ndirectives;
+  set->nunresolved = ndirectives;
+  set->nslots = nslots;
+  set->slots = offsetof(PlanfixDirectiveSet, directives)
+    + ndirectives * sizeof(PlanfixDirective);
+  set->nrefs = 0;
+  set->refs = refsoff;
+  return set;
+}
+
+/* collect the referenced oids and build the hash of a resolved set */
+static void directive_set_index(PlanfixDirectiveSet *set)
+{
+  Oid *refs = (Oid *) SET_PTR(set, set->refs);
+  int i, j;
+
+  set->nrefs = 0;
+  for (i = 0; i < set->ndirectives; i++) {
+    PlanfixDirective *d = &set->directives[i];
+    Oid *indices = directive_indices(set, d);
+    if (d->relation == InvalidOid)
+      continue;
+    refs[set->nrefs++] = d->relation;
+    for (j = 0; j < d->nindices; j++)
+      refs[set->nrefs++] = indices[j];
+  }
+  set->nrefs = oids_sort_unique(refs, set->nrefs);
+  directive_set_build_slots(set);
+}
+
+
+/* the value of token if it starts with keyword, otherwise NULL */
+static const char* option_value(const char *token, const char *keyword)
+{
+  int len = strlen(keyword);
+  if (pg_strncasecmp(token, keyword, len) == 0)
+    return token + len;
+  return NULL;
+}
+
+/* parse a non-negative integer option value */
+static bool option_int64(const char *value, int64 *result)
+{
+  char *end;
+
+  errno = 0;
+  *result = strtoll(value, &end, 10);
+  while (isspace((unsigned char) *end))
+    end++;
+  return errno == 0 && end != value && *end == '\0' && *result >= 0;
+}
+
+/* parse a non-negative floating point option value */
+static bool option_double(const char *value, double *result)
+{
+  char *end;
+
+  errno = 0;
+  *result = strtod(value, &end);
+  while (isspace((unsigned char) *end))
+    end++;
+  return errno == 0 && end != value && *end == '\0' && *result >= 0;
+}
+
+/*
+ * Options are the tokens of a section of the form keyword=value, they
+ * are not names:
+ *
+ *   queryid=N   only for the query with this pg_stat_statements queryid
+ *   limit>=N    only for queries fetching at least N rows (LIMIT plus
+ *               OFFSET), or without a LIMIT
+ *   limit<N     only for queries with a LIMIT, fetching less than N rows
+ *   operator=o  only if a condition on the relation uses an operator
+ *               named o, e.g. operator=@@
+ *   rows=N      for rows, the row estimate is N
+ *   rows*F      for rows, the row estimate is multiplied by F
+ *   rows>=N     for rows, the row estimate is at least N
+ *   rows<=N     for rows, the row estimate is at most N
+ *   workers=N   for parallelworkers, the parallel workers of the
+ *               relation, 0 for no parallel scan
+ *   scope=s     for set, plan to set the parameters while planning,
+ *               execute to keep them while executing as well
+ *   op=name     the op of the directive, forceindex by default
+ *
+ * Returns true if token is an option. If d is given the option is
+ * applied to it, a bad value is reported in *problem.
+ */
+static bool directive_option(const char *token, PlanfixDirective *d,
+			     char **problem)
+{
+  const char *p = token;
+  const char *value;
+  int64 v;
+
+  while (isspace((unsigned char) *p))
+    p++;
+  if ((value = option_value(p, "queryid=")) != NULL) {
+    if (d != NULL) {
+      /* queryids are signed in pg_stat_statements */
+      char *end;
+      errno = 0;
+      v = strtoll(value, &end, 10);
+      while (isspace((unsigned char) *end))
+	end++;
+      if (errno != 0 || end == value || *end != '\0' || v == 0)
+	*problem = psprintf("planfix: invalid queryid in %s", token);
+      else
+	d->opts.queryId = (uint64) v;
+    }
+    return true;
+  }
+  if ((value = option_value(p, "limit>=")) != NULL) {
+    if (d != NULL) {
+      if (!option_int64(value, &v) || v == 0)
+	*problem = psprintf("planfix: invalid limit in %s", token);
+      else
+	d->opts.limitMin = v;
+    }
+    return true;
+  }
+  if ((value = option_value(p, "limit<")) != NULL) {
+    if (d != NULL) {
+      if (!option_int64(value, &v) || v == 0)
+	*problem = psprintf("planfix: invalid limit in %s", token);
+      else
+	d->opts.limitBelow = v;
+    }
+    return true;
+  }
+  if ((value = option_value(p, "operator=")) != NULL) {
+    if (d != NULL) {
+      int len = strlen(value);
+      while (len > 0 && isspace((unsigned char) value[len - 1]))
+	len--;
+      if (len == 0 || len >= NAMEDATALEN)
+	*problem = psprintf("planfix: invalid operator in %s", token);
+      else
+	snprintf(d->opts.operName, NAMEDATALEN, "%.*s", len, value);
+    }
+    return true;
+  }
+  if ((value = option_value(p, "rows>=")) != NULL ||
+      (value = option_value(p, "rows<=")) != NULL ||
+      (value = option_value(p, "rows=")) != NULL ||
+      (value = option_value(p, "rows*")) != NULL) {
+    if (d != NULL) {
+      char kind = p[4];
+      double r;
+      if (!option_double(value, &r) || (kind == '*' && r == 0))
+	*problem = psprintf("planfix: invalid rows in %s", token);
+      else if (kind == '>')
+	d->opts.rowsMin = Max(r, 1.0);
+      else if (kind == '<')
+	d->opts.rowsMax = Max(r, 1.0);
+      else if (kind == '*')
+	d->opts.rowsFactor = r;
+      else
+	d->opts.rows = Max(r, 1.0);
+    }
+    return true;
+  }
+  if ((value = option_value(p, "workers=")) != NULL) {
+    if (d != NULL) {
+      if (!option_int64(value, &v) || v > PLANFIX_MAX_WORKERS)
+	*problem = psprintf("planfix: invalid workers in %s", token);
+      else {
+	d->opts.workersGiven = true;
+	d->opts.workers = (int) v;
+      }
+    }
+    return true;
+  }
+  if ((value = option_value(p, "scope=")) != NULL) {
+    if (d != NULL) {
+      int len = strlen(value);
+      while (len > 0 && isspace((unsigned char) value[len - 1]))
+	len--;
+      if (len == 7 && pg_strncasecmp(value, "execute", len) == 0)
+	d->opts.execute = true;
+      else if (len == 4 && pg_strncasecmp(value, "plan", len) == 0)
+	d->opts.execute = false;
+      else
+	*problem = psprintf("planfix: invalid scope in %s", token);
+    }
+    return true;
+  }
+  if ((value = option_value(p, "op=")) != NULL) {
+    if (d != NULL) {
+      int len = strlen(value);
+      int op;
+      while (len > 0 && isspace((unsigned char) value[len - 1]))
+	len--;
+      op = planfix_op_lookup(value, len);
+      if (op < 0)
+	*problem = psprintf("planfix: unknown op in %s", token);
+      else
+	d->op = (PlanfixOp) op;
+    }
+    return true;
+  }
+  return false;
+}
+
+/*
+ * Apply a comma separated list of options to d, as given to the SQL
+ * functions and in the planfix_directive table. Returns false and sets
+ * *problem if one is not an option or malformed.
+ */
+static bool directive_parse_options(const char *options, PlanfixDirective *d,
+				    char **problem)
+{
+  List *tokens;
+  ListCell *c;
+  char *copy = pstrdup(options);
+
+  *problem = NULL;
+  SimpleStringSplit(copy, ',', &tokens);
+  foreach (c, tokens) {
+    char *token = (char *) lfirst(c);
+    if (!directive_option(token, d, problem) && *problem == NULL)
+      *problem = psprintf("planfix: unknown option %s", token);
+    if (*problem != NULL)
+      break;
+  }
+  list_free_deep(tokens);
+  pfree(copy);
+  return *problem == NULL;
+}
+
+/* the options as text, palloc'd */
+static char* directive_options_text(const PlanfixOptions *opts)
+{
+  StringInfoData buf;
+
+  initStringInfo(&buf);
+  if (opts->queryId != 0)
+    appendStringInfo(&buf, "queryid=" INT64_FORMAT ",", (int64) opts->queryId);
+  if (opts->limitMin != 0)
+    appendStringInfo(&buf, "limit>=" INT64_FORMAT ",", opts->limitMin);
+  if (opts->limitBelow != 0)
+    appendStringInfo(&buf, "limit<" INT64_FORMAT ",", opts->limitBelow);
+  if (opts->operName[0] != '\0')
+    appendStringInfo(&buf, "operator=%s,", opts->operName);
+  if (opts->rows != 0)
+    appendStringInfo(&buf, "rows=%g,", opts->rows);
+  if (opts->rowsFactor != 0)
+    appendStringInfo(&buf, "rows*%g,", opts->rowsFactor);
+  if (opts->rowsMin != 0)
+    appendStringInfo(&buf, "rows>=%g,", opts->rowsMin);
+  if (opts->rowsMax != 0)
+    appendStringInfo(&buf, "rows<=%g,", opts->rowsMax);
+  if (opts->workersGiven)
+    appendStringInfo(&buf, "workers=%d,", opts->workers);
+  if (opts->execute)
+    appendStringInfoString(&buf, "scope=execute,");
+  if (buf.len > 0)
+    buf.data[--buf.len] = '\0';
+  return buf.data;
+}
+
+/*
+ * Split a planfix.forcedindex value into a new, unresolved set, op is
+ * the op of directives without an op= option. This does no catalog
+ * access, the set is palloc'd. Returns NULL and sets *problem if the
+ * value is malformed.
+ */
+static PlanfixDirectiveSet* directive_set_build(const char *value,
+						PlanfixOp op, char **problem)
+{
+  char *rawname = pstrdup(value);
+  List *sections = NULL;
+  List *parsed = NULL;
+  ListCell *c, *c2;
+  PlanfixDirectiveSet *set;
+  int ndirectives = 0, noids = 0, i;
+  Size namelen = 0, oidsoff, namesoff;
+
+  *problem = NULL;
+  SimpleStringSplit(rawname, ';', &sections);
+  foreach(c, sections) {
+    List *section = NULL;
+    int nnames = 0;
+    SimpleStringSplit((char *) lfirst(c), ',', &section);
+    if (section == NULL)
+      continue;
+    foreach (c2, section) {
+      char *token = (char *) lfirst(c2);
+      if (directive_option(token, NULL, NULL))
+	continue;
+      namelen += strlen(token) + 1;
+      nnames++;
+    }
+    if (nnames == 0 && *problem == NULL)
+      *problem = psprintf("planfix: one relation must be defined: %s",
+			  (char *) lfirst(c));
+    parsed = lappend(parsed, section);
+    ndirectives++;
+    noids += Max(nnames - 1, 0);
+  }
+  if (*problem != NULL) {
+    foreach(c, parsed) {
+      list_free_deep((List *) lfirst(c));
+    }
+    list_free(parsed);
+    list_free_deep(sections);
+    pfree(rawname);
+    return NULL;
+  }
+  set = directive_set_alloc(ndirectives, noids, namelen, &oidsoff, &namesoff);
+
+  i = 0;
+  foreach(c, parsed) {
+    List *section = (List *) lfirst(c);
+    PlanfixDirective *d = &set->directives[i++];
+    d->op = op;
+    d->relation = InvalidOid;
+    memset(&d->opts, 0, sizeof(PlanfixOptions));
+    d->nindices = 0;
+    d->indices = oidsoff;
+    d->nnames = 0;
+    d->names = namesoff;
+    d->counter = 0;
+    foreach (c2, section) {
+      char *token = (char *) lfirst(c2);
+      if (directive_option(token, d, problem))
+	continue;
+      strcpy(SET_PTR(set, namesoff), token);
+      namesoff += strlen(token) + 1;
+      d->nnames++;
+    }
+    oidsoff += (d->nnames - 1) * sizeof(Oid);
+    list_free_deep(section);
+  }
+  directive_set_build_slots(set);
+
+  list_free(parsed);
+  list_free_deep(sections);
+  pfree(rawname);
+  if (*problem != NULL) {
+    pfree(set);
+    return NULL;
+  }
+  return set;
+}
+
+
+/* look up one name, on failure set *problem and return InvalidOid */
+static Oid directive_resolve_name(const char *name, char relkind,
+				  char **problem)
+{
+  Oid oid;
+  RangeVar *nameRange;
+  List *qualifiedNameList;
+
+  qualifiedNameList = stringToQualifiedNameList(name);
+  nameRange = makeRangeVarFromNameList(qualifiedNameList);
+  oid = RangeVarGetRelid(nameRange, NoLock, true);
+
+  if (oid == InvalidOid) {
+    *problem = psprintf("planfix: oid invalid for name %s", name);
+  } else if (get_rel_relkind(oid) != relkind) {
+    if (relkind == RELKIND_RELATION)
+      *problem = psprintf("planfix: one relation must be defined first: %s", name);
+    else if (get_rel_relkind(oid) == RELKIND_RELATION)
+      *problem = psprintf("planfix: only one relation must be defined %s", name);
+    else
+      *problem = psprintf("planfix: unhandled relkind for %s", name);
+    oid = InvalidOid;
+  }
+  return oid;
+}
+
+/*
+ * Resolve the names of a set in place. Directives with names that do
+ * not resolve stay inactive, the first problem is reported in *problem
+ * and false is returned. Needs to run inside a transaction.
+ */
+static bool directive_set_resolve(PlanfixDirectiveSet *set, char **problem)
+{
+  int i;
+
+  *problem = NULL;
+  resolving = true;
+  set->validated = invalidationCount;
+  set->nunresolved = 0;
+  set->nrefs = 0;
+  PG_TRY();
+  {
+    for (i = 0; i < set->ndirectives; i++) {
+      PlanfixDirective *d = &set->directives[i];
+      Oid *indices = directive_indices(set, d);
+      char *name = SET_PTR(set, d->names);
+      char relkind = (planfix_op_names_relations(d->op) ?
+		      RELKIND_RELATION : RELKIND_INDEX);
+      char *msg = NULL;
+      int j, n = 0;
+
+      d->counter = 0;
+      d->relation = directive_resolve_name(name, RELKIND_RELATION, &msg);
+      for (j = 1; j < d->nnames && msg == NULL; j++) {
+	name += strlen(name) + 1;
+	if (directive_name_is_setting(d->op, name))
+	  continue;
+	indices[n++] = directive_resolve_name(name, relkind, &msg);
+      }
+      if (msg == NULL && planfix_op_needs_join(d->op) && d->nnames < 2)
+	msg = psprintf("planfix: a join needs at least two relations: %s",
+		       SET_PTR(set, d->names));
+      if (msg != NULL) {
+	d->relation = InvalidOid;
+	d->nindices = 0;
+	set->nunresolved++;
+	if (*problem == NULL)
+	  *problem = msg;
+	continue;
+      }
+      d->nindices = directive_oids_normalize(d->op, indices, n);
+#ifdef PLANFIX_DEBUG
+      directive_print(set, d);
+#endif /* PLANFIX_DEBUG */
+    }
+  }
+  PG_CATCH();
+  {
+    /* e.g. a syntax error in a name, leave all directives inactive */
+    for (i = 0; i < set->ndirectives; i++) {
+      set->directives[i].relation = InvalidOid;
+      set->directives[i].nindices = 0;
+    }
+    set->nunresolved = set->ndirectives;
+    set->nrefs = 0;
+    directive_set_build_slots(set);
+    resolving = false;
+    PG_RE_THROW();
+  }
+  PG_END_TRY();
+
+  directive_set_index(set);
+  resolving = false;
+  return *problem == NULL;
+}
+
+
+/*
+ * The cache key is the value without whitespace outside of quotes,
+ * followed by the default op, the search_path and the user, as the
+ * latter take part in the name resolution.
+ */
+static char* directive_cache_key(const char *value, PlanfixOp op)
+{
+  StringInfoData key;
+  const char *p;
+  bool quoted = false;
+
+  initStringInfo(&key);
+  for (p = value; *p; p++) {
+    if (*p == '"')
+      quoted = !quoted;
+    if (!quoted && isspace((unsigned char) *p))
+      continue;
+    appendStringInfoChar(&key, *p);
+  }
+  appendStringInfo(&key, "\n%s\n%s\n%u", planfixOpNames[op],
+		   namespace_search_path, GetUserId());
+  return key.data;
+}
+
+static void directive_cache_remove(PlanfixCacheEntry *e)
+{
+  directiveCache = list_delete_ptr(directiveCache, e);
+  pfree(e->set);
+  pfree(e->key);
+  pfree(e);
+}
+
+/*
+ * The cached set for key, or NULL. The relcache callback drops the sets
+ * referencing a changed relation, but other invalidations (namespaces,
+ * new relation names) only bump invalidationCount, so a set validated
+ * before is stale as well and dropped here.
+ */
+static PlanfixDirectiveSet* directive_cache_lookup(const char *key)
+{
+  ListCell *c;
+  foreach (c, directiveCache) {
+    PlanfixCacheEntry *e = (PlanfixCacheEntry*) lfirst(c);
+    if (strcmp(e->key, key) == 0) {
+      if (e->set->validated != invalidationCount) {
+	directive_cache_remove(e);
+	return NULL;
+      }
+      /* move to the front, most recently used */
+      if (c != list_head(directiveCache)) {
+	MemoryContext oldmc = MemoryContextSwitchTo(mc);
+	directiveCache = list_delete_ptr(directiveCache, e);
+	directiveCache = lcons(e, directiveCache);
+	MemoryContextSwitchTo(oldmc);
+      }
+      return e->set;
+    }
+  }
+  return NULL;
+}
+
+/* keep a copy of set in the cache */
+static void directive_cache_insert(const char *key, PlanfixDirectiveSet *set)
+{
+  MemoryContext oldmc = MemoryContextSwitchTo(mc);
+  PlanfixCacheEntry *e = palloc(sizeof(PlanfixCacheEntry));
+
+  e->key = pstrdup(key);
+  e->set = palloc(set->size);
+  memcpy(e->set, set, set->size);
+  directiveCache = lcons(e, directiveCache);
+  if (list_length(directiveCache) > PLANFIX_CACHE_SIZE)
+    directive_cache_remove((PlanfixCacheEntry*) llast(directiveCache));
+  MemoryContextSwitchTo(oldmc);
+}
+
+/*
+ * Relcache invalidation, drop all cached sets that reference the
+ * relation, or all of them if relid is invalid. If a session set
+ * references the relation it is marked for resolving again.
+ */
+static void planfixRelcacheCallback(Datum arg, Oid relid)
+{
+  ListCell *c, *next;
+  int i;
+  bool affected = (relid == InvalidOid || resolving);
+
+  for (c = list_head(directiveCache); c != NULL; c = next) {
+    PlanfixCacheEntry *e = (PlanfixCacheEntry*) lfirst(c);
+    next = lnext(c);
+    if (relid == InvalidOid || directive_set_references(e->set, relid)) {
+      directive_cache_remove(e);
+      affected = true;
+    }
+  }
+  for (i = 0; i < PLANFIX_NUM_OPS; i++) {
+    if (sessionSets[i] != NULL &&
+	directive_set_references(sessionSets[i], relid))
+      affected = true;
+  }
+  if (hintSet != NULL && directive_set_references(hintSet, relid))
+    affected = true;
+  if (affected)
+    invalidationCount++;
+
+  if (relid == InvalidOid || relid == tableOid)
+    tableStale = true;
+  /* a column may have changed its type */
+  if (frozenStats != NULL)
+    frozenChecks++;
+  if (relid == InvalidOid || relid == frozenOid || relid == frozenClassOid)
+    frozenStale = true;
+}
+
+/*
+ * Syscache invalidation of pg_class names and of namespaces. A new or
+ * renamed relation may now match a name that did not resolve before,
+ * a namespace change may change what any name resolves to. This also
+ * notices the creation of the planfix_directive table.
+ */
+static void planfixSyscacheCallback(Datum arg, int cacheid, uint32 hashvalue)
+{
+  bool unresolved = (hintSet != NULL && hintSet->nunresolved > 0);
+  int i;
+
+  for (i = 0; i < PLANFIX_NUM_OPS; i++) {
+    if (sessionSets[i] != NULL && sessionSets[i]->nunresolved > 0)
+      unresolved = true;
+  }
+  if (cacheid == NAMESPACEOID || unresolved)
+    invalidationCount++;
+
+  /* the directive table may have been created */
+  if (tableOid == InvalidOid)
+    tableStale = true;
+  if (frozenOid == InvalidOid)
+    frozenStale = true;
+}
+
+
+
+/*
+ * Dealing with set,check,show of forced and disabled index.
+ *
+ * All the catalog work happens in the check hook, which hands the
+ * resolved set to the assign hook as its extra. Outside of a transaction
+ * (e.g. for postgresql.conf) names cannot be looked up, so the set is
+ * resolved on first use by the planner hook instead. The same is done
+ * for per-role and per-database settings and in parallel workers,
+ * where search_path may be set only after this value.
+ */
+static bool directive_guc_check(char **newval, void **extra, GucSource source,
+				PlanfixOp op)
+{
+  PlanfixDirectiveSet *set = NULL;
+  PlanfixDirectiveSet *built = NULL;
+  char *key = NULL;
+
+  if (*newval == NULL || (*newval)[0] == '\0')
+    return true;
+
+  if (IsTransactionState() && source >= PGC_S_INTERACTIVE &&
+      !IsParallelWorker()) {
+    key = directive_cache_key(*newval, op);
+    set = directive_cache_lookup(key);
+  }
+  if (set == NULL) {
+    char *problem;
+    set = built = directive_set_build(*newval, op, &problem);
+    if (set == NULL) {
+      GUC_check_errdetail("%s", problem);
+      if (key != NULL)
+	pfree(key);
+      return false;
+    }
+    if (key != NULL) {
+      if (directive_set_resolve(set, &problem)) {
+	directive_cache_insert(key, set);
+      } else if (source == PGC_S_TEST) {
+	ereport(NOTICE,
+		(errcode(ERRCODE_UNDEFINED_OBJECT),
+		 errmsg("%s", problem)));
+      } else {
+	GUC_check_errdetail("%s", problem);
+	pfree(built);
+	pfree(key);
+	return false;
+      }
+    }
+  }
+
+  *extra = guc_malloc(LOG, set->size);
+  if (*extra != NULL)
+    memcpy(*extra, set, set->size);
+  if (built != NULL)
+    pfree(built);
+  if (key != NULL)
+    pfree(key);
+  return *extra != NULL;
+}
+
+
+static bool varForcedIndexCheck(char **newval, void **extra, GucSource source)
+{
+  return directive_guc_check(newval, extra, source, PLANFIX_OP_FORCEINDEX);
+}
+
+static void varForcedIndexAssign(const char *newval, void *extra)
+{
+  sessionSets[PLANFIX_OP_FORCEINDEX] = (PlanfixDirectiveSet*) extra;
+}
+
+static bool varDisabledIndexCheck(char **newval, void **extra,
+				  GucSource source)
+{
+  return directive_guc_check(newval, extra, source, PLANFIX_OP_DISABLEINDEX);
+}
+
+static void varDisabledIndexAssign(const char *newval, void *extra)
+{
+  sessionSets[PLANFIX_OP_DISABLEINDEX] = (PlanfixDirectiveSet*) extra;
+}
+
+static bool varPreferredIndexCheck(char **newval, void **extra,
+				   GucSource source)
+{
+  return directive_guc_check(newval, extra, source, PLANFIX_OP_PREFERINDEX);
+}
+
+static void varPreferredIndexAssign(const char *newval, void *extra)
+{
+  sessionSets[PLANFIX_OP_PREFERINDEX] = (PlanfixDirectiveSet*) extra;
+}
+
+static bool varNestLoopCheck(char **newval, void **extra, GucSource source)
+{
+  return directive_guc_check(newval, extra, source, PLANFIX_OP_NESTLOOP);
+}
+
+static void varNestLoopAssign(const char *newval, void *extra)
+{
+  sessionSets[PLANFIX_OP_NESTLOOP] = (PlanfixDirectiveSet*) extra;
+}
+
+static bool varHashJoinCheck(char **newval, void **extra, GucSource source)
+{
+  return directive_guc_check(newval, extra, source, PLANFIX_OP_HASHJOIN);
+}
+
+static void varHashJoinAssign(const char *newval, void *extra)
+{
+  sessionSets[PLANFIX_OP_HASHJOIN] = (PlanfixDirectiveSet*) extra;
+}
+
+static bool varMergeJoinCheck(char **newval, void **extra, GucSource source)
+{
+  return directive_guc_check(newval, extra, source, PLANFIX_OP_MERGEJOIN);
+}
+
+static void varMergeJoinAssign(const char *newval, void *extra)
+{
+  sessionSets[PLANFIX_OP_MERGEJOIN] = (PlanfixDirectiveSet*) extra;
+}
+
+static bool varLeadingCheck(char **newval, void **extra, GucSource source)
+{
+  return directive_guc_check(newval, extra, source, PLANFIX_OP_LEADING);
+}
+
+static void varLeadingAssign(const char *newval, void *extra)
+{
+  sessionSets[PLANFIX_OP_LEADING] = (PlanfixDirectiveSet*) extra;
+}
+
+static bool varRowsCheck(char **newval, void **extra, GucSource source)
+{
+  return directive_guc_check(newval, extra, source, PLANFIX_OP_ROWS);
+}
+
+static void varRowsAssign(const char *newval, void *extra)
+{
+  sessionSets[PLANFIX_OP_ROWS] = (PlanfixDirectiveSet*) extra;
+}
+
+static bool varSeqScanCheck(char **newval, void **extra, GucSource source)
+{
+  return directive_guc_check(newval, extra, source, PLANFIX_OP_SEQSCAN);
+}
+
+static void varSeqScanAssign(const char *newval, void *extra)
+{
+  sessionSets[PLANFIX_OP_SEQSCAN] = (PlanfixDirectiveSet*) extra;
+}
+
+static bool varIndexScanCheck(char **newval, void **extra, GucSource source)
+{
+  return directive_guc_check(newval, extra, source, PLANFIX_OP_INDEXSCAN);
+}
+
+static void varIndexScanAssign(const char *newval, void *extra)
+{
+  sessionSets[PLANFIX_OP_INDEXSCAN] = (PlanfixDirectiveSet*) extra;
+}
+
+static bool varIndexOnlyScanCheck(char **newval, void **extra,
+				  GucSource source)
+{
+  return directive_guc_check(newval, extra, source, PLANFIX_OP_INDEXONLYSCAN);
+}
+
+static void varIndexOnlyScanAssign(const char *newval, void *extra)
+{
+  sessionSets[PLANFIX_OP_INDEXONLYSCAN] = (PlanfixDirectiveSet*) extra;
+}
+
+static bool varBitmapScanCheck(char **newval, void **extra, GucSource source)
+{
+  return directive_guc_check(newval, extra, source, PLANFIX_OP_BITMAPSCAN);
+}
+
+static void varBitmapScanAssign(const char *newval, void *extra)
+{
+  sessionSets[PLANFIX_OP_BITMAPSCAN] = (PlanfixDirectiveSet*) extra;
+}
+
+static bool varParallelWorkersCheck(char **newval, void **extra,
+				    GucSource source)
+{
+  return directive_guc_check(newval, extra, source,
+			     PLANFIX_OP_PARALLELWORKERS);
+}
+
+static void varParallelWorkersAssign(const char *newval, void *extra)
+{
+  sessionSets[PLANFIX_OP_PARALLELWORKERS] = (PlanfixDirectiveSet*) extra;
+}
+
+static bool varSetCheck(char **newval, void **extra, GucSource source)
+{
+  return directive_guc_check(newval, extra, source, PLANFIX_OP_SET);
+}
+
+static void varSetAssign(const char *newval, void *extra)
+{
+  sessionSets[PLANFIX_OP_SET] = (PlanfixDirectiveSet*) extra;
+}
+
+
+static const char* varForcedIndexShow()
+{
+  char *v;
+  v = palloc(strlen(varForcedIndex) + 1);
+  strcpy(v, varForcedIndex);
+  return v;
+}
+
+
+
+/*
+ * Shared directives, registered by an admin through
+ * planfix_add_directive and in effect for all backends of the
+ * database. Only available when planfix is loaded through
+ * shared_preload_libraries.
+ *
+ * Writers change the table under the exclusive lock and bump the
+ * generation. Backends keep a local set built from the table and only
+ * rebuild it when the generation changed, so in the steady state the
+ * planner hook does a single atomic read.
+ */
+static void planfixShmemStartup(void)
+{
+  bool found;
+
+  if (oldShmemStartupHook)
+    oldShmemStartupHook();
+
+  LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+  shared = ShmemInitStruct("planfix", sizeof(PlanfixShared), &found);
+  if (!found) {
+    int i;
+    shared->lock = &(GetNamedLWLockTranche("planfix"))->lock;
+    pg_atomic_init_u32(&shared->generation, 1);
+    shared->ndirectives = 0;
+    for (i = 0; i < PLANFIX_MAX_COUNTERS; i++) {
+      PlanfixCounter *counter = &shared->counters[i];
+      pg_atomic_init_u32(&counter->used, 0);
+      pg_atomic_init_u64(&counter->matched, 0);
+      pg_atomic_init_u64(&counter->pruned, 0);
+      pg_atomic_init_u64(&counter->micros, 0);
+      pg_atomic_init_u64(&counter->lastHit, 0);
+    }
+    for (i = 0; i < PLANFIX_NUM_TIMINGS; i++) {
+      PlanfixHistogram *h = &shared->timings[i];
+      int j;
+      pg_atomic_init_u64(&h->statements, 0);
+      pg_atomic_init_u64(&h->micros, 0);
+      for (j = 0; j < PLANFIX_TIMING_BUCKETS; j++)
+	pg_atomic_init_u64(&h->buckets[j], 0);
+    }
+  }
+  LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Directive counters. Each directive that is applied counts in a slot
+ * of an open addressing table in shared memory, so the steady state
+ * is a few atomic operations on a slot remembered in the directive.
+ * Slots are never freed. A directive whose counters are not found
+ * within PLANFIX_COUNTER_PROBES slots, which all are taken, is not
+ * counted, and that is remembered in the directive as well. Without
+ * shared memory nothing is counted.
+ */
+static PlanfixCounter* planfix_counter(PlanfixDirectiveSet *set,
+				       PlanfixDirective *d)
+{
+  PlanfixSharedDirective key;
+  uint32 hash, i;
+
+  if (shared == NULL)
+    return NULL;
+  if (d->counter > 0)
+    return &shared->counters[d->counter - 1];
+  if (d->counter < 0)
+    return NULL;
+
+  memset(&key, 0, sizeof(key));
+  key.database = MyDatabaseId;
+  key.op = d->op;
+  key.relation = d->relation;
+  memcpy(&key.opts, &d->opts, sizeof(PlanfixOptions));
+  key.nindices = Min(d->nindices, PLANFIX_MAX_INDICES);
+  memcpy(key.indices, directive_indices(set, d), key.nindices * sizeof(Oid));
+  hash = DatumGetUInt32(hash_any((unsigned char *) &key, sizeof(key)));
+
+  for (i = 0; i < PLANFIX_COUNTER_PROBES; i++) {
+    uint32 slot = (hash + i) & (PLANFIX_MAX_COUNTERS - 1);
+    PlanfixCounter *counter = &shared->counters[slot];
+    if (pg_atomic_read_u32(&counter->used) == 0) {
+      LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+      if (pg_atomic_read_u32(&counter->used) == 0) {
+	counter->key = key;
+	pg_write_barrier();
+	pg_atomic_write_u32(&counter->used, 1);
+	LWLockRelease(shared->lock);
+	d->counter = slot + 1;
+	return counter;
+      }
+      /* taken by another backend meanwhile */
+      LWLockRelease(shared->lock);
+    }
+    pg_read_barrier();
+    if (memcmp(&counter->key, &key, sizeof(key)) == 0) {
+      d->counter = slot + 1;
+      return counter;
+    }
+  }
+  d->counter = -1;
+  return NULL;
+}
+
+/*
+ * The counters of the directives applied in the hook call being timed,
+ * which is charged with the time of the call, split evenly. Directives
+ * applied outside of a timed hook call get no time. ntimedCounters is
+ * -1 while no hook call is timed.
+ */
+#define PLANFIX_TIMED_COUNTERS 8
+
+static PlanfixCounter *timedCounters[PLANFIX_TIMED_COUNTERS];
+static int ntimedCounters = -1;
+
+static void planfix_timing_attribute(PlanfixCounter *counter)
+{
+  int i;
+
+  if (ntimedCounters < 0)
+    return;
+  for (i = 0; i < ntimedCounters; i++) {
+    if (timedCounters[i] == counter)
+      return;
+  }
+  if (ntimedCounters < PLANFIX_TIMED_COUNTERS)
+    timedCounters[ntimedCounters++] = counter;
+}
+
+/* count an application of d, which removed pruned indices */
+static void planfix_count(PlanfixDirectiveSet *set, PlanfixDirective *d,
+			  int pruned)
+{
+  PlanfixCounter *counter = planfix_counter(set, d);
+
+  if (counter == NULL)
+    return;
+  planfix_timing_attribute(counter);
+  pg_atomic_fetch_add_u64(&counter->matched, 1);
+  if (pruned > 0)
+    pg_atomic_fetch_add_u64(&counter->pruned, pruned);
+  pg_atomic_write_u64(&counter->lastHit,
+		      (uint64) GetCurrentStatementStartTimestamp());
+}
+
+/*
+ * Timings. With planfix.track_timing the time spent in planfix while
+ * planning a statement and the planning time of the statement go into
+ * log-linear histograms in shared memory, one atomic addition per
+ * bucket, count and sum. The time in planfix is summed up per statement
+ * in planfixTime, nested timings are not counted twice.
+ */
+static double planfixTime = 0;		/* microseconds of this statement */
+static bool timingActive = false;	/* a timing is running */
+
+/* the bucket of a timing in microseconds */
+static int timing_bucket(uint64 micros)
+{
+  int e = 0;
+
+  if (micros < PLANFIX_TIMING_SUBBUCKETS)
+    return (int) micros;
+  if (micros > PG_UINT32_MAX)
+    micros = PG_UINT32_MAX;
+  while ((micros >> e) >= 2 * PLANFIX_TIMING_SUBBUCKETS)
+    e++;
+  /* micros >> e is in [SUBBUCKETS, 2 * SUBBUCKETS) */
+  return (e + 1) * PLANFIX_TIMING_SUBBUCKETS +
+    (int) (micros >> e) - PLANFIX_TIMING_SUBBUCKETS;
+}
+
+/* the smallest timing of a bucket */
+static uint64 timing_bucket_lower(int bucket)
+{
+  int e = bucket / PLANFIX_TIMING_SUBBUCKETS - 1;
+
+  if (bucket < PLANFIX_TIMING_SUBBUCKETS)
+    return bucket;
+  return ((uint64) (PLANFIX_TIMING_SUBBUCKETS +
+		    bucket % PLANFIX_TIMING_SUBBUCKETS)) << e;
+}
+
+static void planfix_timing_record(PlanfixTiming kind, double micros)
+{
+  PlanfixHistogram *h;
+  uint64 v = (uint64) Max(micros, 0);
+
+  if (shared == NULL)
+    return;
+  h = &shared->timings[kind];
+  pg_atomic_fetch_add_u64(&h->buckets[timing_bucket(v)], 1);
+  pg_atomic_fetch_add_u64(&h->statements, 1);
+  pg_atomic_fetch_add_u64(&h->micros, v);
+}
+
+static void planfix_timing_start(instr_time *start)
+{
+  INSTR_TIME_SET_ZERO(*start);
+  if (varTrackTiming && !timingActive) {
+    timingActive = true;
+    ntimedCounters = 0;
+    INSTR_TIME_SET_CURRENT(*start);
+  }
+}
+
+static void planfix_timing_end(instr_time *start)
+{
+  instr_time now;
+  double micros;
+  int i;
+
+  if (INSTR_TIME_IS_ZERO(*start))
+    return;
+  INSTR_TIME_SET_CURRENT(now);
+  INSTR_TIME_SUBTRACT(now, *start);
+  micros = INSTR_TIME_GET_DOUBLE(now) * 1000000.0;
+  planfixTime += micros;
+  for (i = 0; i < ntimedCounters; i++)
+    pg_atomic_fetch_add_u64(&timedCounters[i]->micros,
+			    (uint64) (micros / ntimedCounters));
+  ntimedCounters = -1;
+  timingActive = false;
+}
+
+/*
+ * Build a set in mc from n resolved directives with noids indices in
+ * total. Such a set has no names and is never resolved again.
+ */
+static PlanfixDirectiveSet* directive_set_from_oids(PlanfixSharedDirective *dirs,
+						    int n, int noids)
+{
+  MemoryContext oldmc = MemoryContextSwitchTo(mc);
+  PlanfixDirectiveSet *set;
+  Size oidsoff, namesoff;
+  int i;
+
+  set = directive_set_alloc(n, noids, 0, &oidsoff, &namesoff);
+  MemoryContextSwitchTo(oldmc);
+  for (i = 0; i < n; i++) {
+    PlanfixDirective *d = &set->directives[i];
+    d->op = dirs[i].op;
+    d->relation = dirs[i].relation;
+    d->opts = dirs[i].opts;
+    d->nindices = dirs[i].nindices;
+    d->indices = oidsoff;
+    d->nnames = 0;
+    d->names = namesoff;
+    d->counter = 0;
+    memcpy(SET_PTR(set, oidsoff), dirs[i].indices,
+	   dirs[i].nindices * sizeof(Oid));
+    oidsoff += dirs[i].nindices * sizeof(Oid);
+  }
+  set->nunresolved = 0;
+  set->validated = invalidationCount;
+  directive_set_index(set);
+  return set;
+}
+
+/* bring the local copy of the shared directives up to date */
+static void planfix_shared_refresh(void)
+{
+  PlanfixSharedDirective *copy;
+  PlanfixDirectiveSet *set = NULL;
+  uint32 generation;
+  int i, n = 0, noids = 0;
+
+  if (shared == NULL)
+    return;
+  generation = pg_atomic_read_u32(&shared->generation);
+  if (generation == sharedGeneration)
+    return;
+
+  copy = palloc(PLANFIX_MAX_DIRECTIVES * sizeof(PlanfixSharedDirective));
+  LWLockAcquire(shared->lock, LW_SHARED);
+  generation = pg_atomic_read_u32(&shared->generation);
+  for (i = 0; i < shared->ndirectives; i++) {
+    if (shared->directives[i].database == MyDatabaseId) {
+      copy[n] = shared->directives[i];
+      noids += copy[n].nindices;
+      n++;
+    }
+  }
+  LWLockRelease(shared->lock);
+
+  if (n > 0)
+    set = directive_set_from_oids(copy, n, noids);
+  pfree(copy);
+
+  if (sharedSet != NULL)
+    pfree(sharedSet);
+  sharedSet = set;
+  sharedGeneration = generation;
+}
+
+
+
+/*
+ * The schema the planfix extension is installed in, or InvalidOid if it
+ * is not installed in the current database. get_extension_schema is
+ * not exported by the server, so pg_extension is scanned here.
+ */
+static Oid planfix_schema(void)
+{
+  Relation relation;
+  SysScanDesc scan;
+  HeapTuple tuple;
+  ScanKeyData key;
+  Oid schema = InvalidOid;
+
+  relation = heap_open(ExtensionRelationId, AccessShareLock);
+  ScanKeyInit(&key, Anum_pg_extension_extname, BTEqualStrategyNumber,
+	      F_NAMEEQ, CStringGetDatum("planfix"));
+  scan = systable_beginscan(relation, ExtensionNameIndexId, true, NULL,
+			    1, &key);
+  tuple = systable_getnext(scan);
+  if (HeapTupleIsValid(tuple))
+    schema = ((Form_pg_extension) GETSTRUCT(tuple))->extnamespace;
+  systable_endscan(scan);
+  heap_close(relation, AccessShareLock);
+  return schema;
+}
+
+
+
+/*
+ * Directives stored in the planfix_directive table of the extension,
+ * loaded on the first use by the planner hook and again after the
+ * table changed. The table's trigger invalidates its relcache entry on
+ * every change, which reaches all backends through the relcache
+ * callback.
+ */
+static void planfix_table_refresh(void)
+{
+  Oid schema;
+  Relation relation;
+  Snapshot snapshot;
+  HeapScanDesc scan;
+  HeapTuple tuple;
+  PlanfixSharedDirective *dirs;
+  int n = 0, max = 16, noids = 0;
+
+  if (!tableStale)
+    return;
+  tableStale = false;
+
+  if (tableSet != NULL) {
+    pfree(tableSet);
+    tableSet = NULL;
+  }
+  tableOid = InvalidOid;
+  schema = planfix_schema();
+  if (schema != InvalidOid)
+    tableOid = get_relname_relid("planfix_directive", schema);
+  if (tableOid == InvalidOid)
+    return;
+
+  dirs = palloc(max * sizeof(PlanfixSharedDirective));
+  relation = heap_open(tableOid, AccessShareLock);
+  snapshot = RegisterSnapshot(GetLatestSnapshot());
+  scan = heap_beginscan(relation, snapshot, 0, NULL);
+  while ((tuple = heap_getnext(scan, ForwardScanDirection)) != NULL) {
+    Datum values[6];
+    bool nulls[6];
+    Datum *elems;
+    bool *elemnulls;
+    int i, nelems;
+    PlanfixSharedDirective *d;
+
+    /* relation, indexes, op, queryid, options, enabled */
+    heap_deform_tuple(tuple, RelationGetDescr(relation), values, nulls);
+    if (nulls[0] || nulls[1] || nulls[2] ||
+	(!nulls[5] && !DatumGetBool(values[5])))
+      continue;
+
+    if (n == max) {
+      max *= 2;
+      dirs = repalloc(dirs, max * sizeof(PlanfixSharedDirective));
+    }
+    d = &dirs[n++];
+    memset(d, 0, sizeof(PlanfixSharedDirective));
+    d->database = MyDatabaseId;
+    d->op = planfix_op_from_name(TextDatumGetCString(values[2]));
+    d->relation = DatumGetObjectId(values[0]);
+    if (!nulls[4]) {
+      PlanfixDirective parsed;
+      char *problem;
+      parsed.op = d->op;
+      memset(&parsed.opts, 0, sizeof(PlanfixOptions));
+      if (!directive_parse_options(TextDatumGetCString(values[4]), &parsed,
+				   &problem)) {
+	elog(WARNING, "%s", problem);
+	n--;
+	continue;
+      }
+      d->op = parsed.op;
+      d->opts = parsed.opts;
+    }
+    if (!nulls[3])
+      d->opts.queryId = (uint64) DatumGetInt64(values[3]);
+    deconstruct_array(DatumGetArrayTypeP(values[1]), REGCLASSOID,
+		      sizeof(Oid), true, 'i', &elems, &elemnulls, &nelems);
+    for (i = 0; i < nelems && d->nindices < PLANFIX_MAX_INDICES; i++) {
+      if (!elemnulls[i])
+	d->indices[d->nindices++] = DatumGetObjectId(elems[i]);
+    }
+    d->nindices = directive_oids_normalize(d->op, d->indices, d->nindices);
+    noids += d->nindices;
+  }
+  heap_endscan(scan);
+  UnregisterSnapshot(snapshot);
+  heap_close(relation, AccessShareLock);
+
+  if (n > 0)
+    tableSet = directive_set_from_oids(dirs, n, noids);
+  pfree(dirs);
+}
+
+
+
+/*
+ * Frozen statistics. planfix_freeze_stats copies the pg_statistic rows
+ * of a relation and its indices into the planfix_frozen_stats table,
+ * each as the raw tuple. Until planfix_unfreeze_stats the planner is
+ * handed these instead of the current ones, so an ANALYZE does not
+ * change the plans. Every backend keeps the table in a hash and loads
+ * it again when it changed, as for planfix_directive.
+ *
+ * The planfix_frozen_class table overrides the size of relations and
+ * indices, relpages, reltuples and relallvisible as in pg_class. Both
+ * tables are filled by planfix_import_stats from a file written by
+ * planfix_export_stats on another cluster, so a small database can be
+ * planned like the one the file came from.
+ */
+typedef struct PlanfixFrozenKey_ {
+  Oid relation;
+  int16 attnum;
+  bool inherit;
+} PlanfixFrozenKey;
+
+typedef struct PlanfixFrozenEntry_ {
+  PlanfixFrozenKey key;
+  HeapTuple tuple;		/* the pg_statistic tuple, in mc */
+  uint32 checked;		/* frozenChecks when last checked, 0 never */
+  bool fits;			/* the values are of the column's type */
+} PlanfixFrozenEntry;
+
+typedef struct PlanfixFrozenClass_ {
+  Oid relation;
+  BlockNumber pages;
+  double tuples;
+  BlockNumber allvisible;
+} PlanfixFrozenClass;
+
+/* load planfix_frozen_class into frozenClass */
+static void planfix_frozen_class_load(void)
+{
+  Relation relation;
+  Snapshot snapshot;
+  HeapScanDesc scan;
+  HeapTuple tuple;
+  HASHCTL ctl;
+
+  if (frozenClassOid == InvalidOid)
+    return;
+
+  memset(&ctl, 0, sizeof(ctl));
+  ctl.keysize = sizeof(Oid);
+  ctl.entrysize = sizeof(PlanfixFrozenClass);
+  ctl.hcxt = mc;
+  frozenClass = hash_create("planfix frozen class", 64, &ctl,
+			    HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+  relation = heap_open(frozenClassOid, AccessShareLock);
+  snapshot = RegisterSnapshot(GetLatestSnapshot());
+  scan = heap_beginscan(relation, snapshot, 0, NULL);
+  while ((tuple = heap_getnext(scan, ForwardScanDirection)) != NULL) {
+    Datum values[4];
+    bool nulls[4];
+    Oid oid;
+    PlanfixFrozenClass *e;
+
+    heap_deform_tuple(tuple, RelationGetDescr(relation), values, nulls);
+    if (nulls[0] || nulls[1] || nulls[2])
+      continue;
+    oid = DatumGetObjectId(values[0]);
+    e = (PlanfixFrozenClass *) hash_search(frozenClass, &oid, HASH_ENTER,
+					   NULL);
+    e->pages = (BlockNumber) Max(DatumGetInt32(values[1]), 0);
+    e->tuples = Max(DatumGetFloat4(values[2]), 0);
+    e->allvisible = (nulls[3] ? 0 :
+		     (BlockNumber) Max(DatumGetInt32(values[3]), 0));
+  }
+  heap_endscan(scan);
+  UnregisterSnapshot(snapshot);
+  heap_close(relation, AccessShareLock);
+
+  if (hash_get_num_entries(frozenClass) == 0) {
+    hash_destroy(frozenClass);
+    frozenClass = NULL;
+  }
+}
+
+/* a pg_statistic tuple from its raw bytes, in mc, NULL if malformed */
+static HeapTuple frozen_tuple(bytea *raw)
+{
+  int len = VARSIZE_ANY_EXHDR(raw);
+  HeapTuple tuple;
+
+  if (len < SizeofHeapTupleHeader)
+    return NULL;
+  tuple = MemoryContextAlloc(mc, HEAPTUPLESIZE + len);
+  tuple->t_len = len;
+  ItemPointerSetInvalid(&tuple->t_self);
+  tuple->t_tableOid = StatisticRelationId;
+  tuple->t_data = (HeapTupleHeader) ((char *) tuple + HEAPTUPLESIZE);
+  memcpy(tuple->t_data, VARDATA_ANY(raw), len);
+  if (tuple->t_data->t_hoff > len ||
+      HeapTupleHeaderGetNatts(tuple->t_data) != Natts_pg_statistic) {
+    pfree(tuple);
+    return NULL;
+  }
+  return tuple;
+}
+
+static void planfix_frozen_refresh(void)
+{
+  Oid schema;
+  Relation relation;
+  Snapshot snapshot;
+  HeapScanDesc scan;
+  HeapTuple tuple;
+  HASHCTL ctl;
+
+  if (!frozenStale)
+    return;
+  frozenStale = false;
+
+  if (frozenStats != NULL) {
+    HASH_SEQ_STATUS status;
+    PlanfixFrozenEntry *e;
+    hash_seq_init(&status, frozenStats);
+    while ((e = (PlanfixFrozenEntry *) hash_seq_search(&status)) != NULL)
+      pfree(e->tuple);
+    hash_destroy(frozenStats);
+    frozenStats = NULL;
+  }
+  if (frozenClass != NULL) {
+    hash_destroy(frozenClass);
+    frozenClass = NULL;
+  }
+  frozenOid = InvalidOid;
+  frozenClassOid = InvalidOid;
+  schema = planfix_schema();
+  if (schema != InvalidOid) {
+    frozenOid = get_relname_relid("planfix_frozen_stats", schema);
+    frozenClassOid = get_relname_relid("planfix_frozen_class", schema);
+  }
+  planfix_frozen_class_load();
+  if (frozenOid == InvalidOid)
+    return;
+
+  memset(&ctl, 0, sizeof(ctl));
+  ctl.keysize = sizeof(PlanfixFrozenKey);
+  ctl.entrysize = sizeof(PlanfixFrozenEntry);
+  ctl.hcxt = mc;
+  frozenStats = hash_create("planfix frozen stats", 64, &ctl,
+			    HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+  relation = heap_open(frozenOid, AccessShareLock);
+  snapshot = RegisterSnapshot(GetLatestSnapshot());
+  scan = heap_beginscan(relation, snapshot, 0, NULL);
+  while ((tuple = heap_getnext(scan, ForwardScanDirection)) != NULL) {
+    Datum values[4];
+    bool nulls[4];
+    PlanfixFrozenKey key;
+    PlanfixFrozenEntry *e;
+    HeapTuple frozen;
+    bool found;
+
+    heap_deform_tuple(tuple, RelationGetDescr(relation), values, nulls);
+    if (nulls[0] || nulls[1] || nulls[2] || nulls[3])
+      continue;
+    frozen = frozen_tuple(DatumGetByteaPP(values[3]));
+    if (frozen == NULL) {
+      elog(WARNING, "planfix: malformed frozen statistics of %s",
+	   get_rel_name(DatumGetObjectId(values[0])));
+      continue;
+    }
+    memset(&key, 0, sizeof(key));
+    key.relation = DatumGetObjectId(values[0]);
+    key.attnum = DatumGetInt16(values[1]);
+    key.inherit = DatumGetBool(values[2]);
+    e = (PlanfixFrozenEntry *) hash_search(frozenStats, &key, HASH_ENTER,
+					   &found);
+    if (found)
+      pfree(e->tuple);
+    e->tuple = frozen;
+    e->checked = 0;
+  }
+  heap_endscan(scan);
+  UnregisterSnapshot(snapshot);
+  heap_close(relation, AccessShareLock);
+
+  if (hash_get_num_entries(frozenStats) == 0) {
+    hash_destroy(frozenStats);
+    frozenStats = NULL;
+  }
+}
+
+/*
+ * The type ANALYZE would collect statistics of for a column now, that
+ * of the expression for an expression column of an index. InvalidOid
+ * if the column is gone.
+ */
+static Oid frozen_column_type(Oid relation, AttrNumber attnum)
+{
+  Relation index;
+  Form_pg_index form;
+  Oid type = InvalidOid;
+  int i, nexpr = 0;
+
+  if (get_rel_relkind(relation) != RELKIND_INDEX)
+    return get_atttype(relation, attnum);
+
+  index = index_open(relation, AccessShareLock);
+  form = index->rd_index;
+  if (attnum >= 1 && attnum <= form->indnatts) {
+    if (form->indkey.values[attnum - 1] != 0) {
+      type = get_atttype(form->indrelid, form->indkey.values[attnum - 1]);
+    } else {
+      List *exprs = RelationGetIndexExpressions(index);
+      for (i = 0; i < attnum - 1; i++) {
+	if (form->indkey.values[i] == 0)
+	  nexpr++;
+      }
+      if (nexpr < list_length(exprs))
+	type = exprType((Node *) list_nth(exprs, nexpr));
+      list_free_deep(exprs);
+    }
+  }
+  index_close(index, AccessShareLock);
+  return type;
+}
+
+/*
+ * Whether the values of a frozen statistics tuple are still of the type
+ * of its column. The statistics of ANALYZE are dropped when the type of
+ * a column changes, frozen ones are not, and values of another type must
+ * never reach the operators of the column. The most common values and
+ * histograms are of the column's type, the most common elements of its
+ * element type, text for tsvector.
+ */
+static bool frozen_tuple_fits(Oid relation, AttrNumber attnum,
+			      HeapTuple tuple)
+{
+  Form_pg_statistic stats = (Form_pg_statistic) GETSTRUCT(tuple);
+  Oid type = frozen_column_type(relation, attnum);
+  int i;
+
+  if (type == InvalidOid)
+    return false;
+  for (i = 0; i < STATISTIC_NUM_SLOTS; i++) {
+    int16 kind = (&stats->stakind1)[i];
+    Oid expected;
+    Datum values;
+    ArrayType *array;
+    bool isnull, fits;
+
+    if (kind == STATISTIC_KIND_MCV || kind == STATISTIC_KIND_HISTOGRAM ||
+	kind == STATISTIC_KIND_BOUNDS_HISTOGRAM)
+      expected = type;
+    else if (kind == STATISTIC_KIND_MCELEM)
+      expected = (type == TSVECTOROID ? TEXTOID : get_base_element_type(type));
+    else
+      continue;
+    values = SysCacheGetAttr(STATRELATTINH, tuple,
+			     Anum_pg_statistic_stavalues1 + i, &isnull);
+    if (isnull)
+      continue;
+    array = DatumGetArrayTypeP(values);
+    fits = (ARR_ELEMTYPE(array) == expected);
+    if ((Pointer) array != DatumGetPointer(values))
+      pfree(array);
+    if (!fits)
+      return false;
+  }
+  return true;
+}
+
+/*
+ * Hand out a copy of the frozen statistics, false if there are none or
+ * they no longer fit the column, then the current ones are used.
+ */
+static bool planfix_frozen_stats(Oid relation, AttrNumber attnum,
+				 bool inherit, VariableStatData *vardata)
+{
+  PlanfixFrozenKey key;
+  PlanfixFrozenEntry *e;
+
+  planfix_frozen_refresh();
+  if (frozenStats == NULL)
+    return false;
+  memset(&key, 0, sizeof(key));
+  key.relation = relation;
+  key.attnum = attnum;
+  key.inherit = inherit;
+  e = (PlanfixFrozenEntry *) hash_search(frozenStats, &key, HASH_FIND, NULL);
+  if (e == NULL)
+    return false;
+  if (e->checked != frozenChecks) {
+    e->fits = frozen_tuple_fits(relation, attnum, e->tuple);
+    e->checked = frozenChecks;
+  }
+  if (!e->fits)
+    return false;
+  vardata->statsTuple = heap_copytuple(e->tuple);
+  vardata->freefunc = heap_freetuple;
+  return true;
+}
+
+/*
+ * Apply the frozen sizes of the relation and its indices, in place of
+ * those get_relation_info derived from the current size.
+ */
+static void planfix_frozen_sizes(Oid relationObjectId, RelOptInfo *rel)
+{
+  PlanfixFrozenClass *e;
+  ListCell *c;
+
+  planfix_frozen_refresh();
+  if (frozenClass == NULL)
+    return;
+  e = (PlanfixFrozenClass *) hash_search(frozenClass, &relationObjectId,
+					 HASH_FIND, NULL);
+  if (e != NULL) {
+    rel->pages = e->pages;
+    rel->tuples = e->tuples;
+    if (e->pages > 0)
+      rel->allvisfrac = Min((double) e->allvisible / e->pages, 1.0);
+    else
+      rel->allvisfrac = 0;
+  }
+  foreach (c, rel->indexlist) {
+    IndexOptInfo *info = (IndexOptInfo *) lfirst(c);
+    e = (PlanfixFrozenClass *) hash_search(frozenClass, &info->indexoid,
+					   HASH_FIND, NULL);
+    if (e == NULL)
+      continue;
+    info->pages = e->pages;
+    /* as get_relation_info, a partial index has at most the rel tuples */
+    info->tuples = (info->indpred == NIL ? rel->tuples :
+		    Min(e->tuples, rel->tuples));
+  }
+}
+
+static bool planfixRelationStatsHook(PlannerInfo *root, RangeTblEntry *rte,
+				     AttrNumber attnum,
+				     VariableStatData *vardata)
+{
+  if (rte->rtekind == RTE_RELATION &&
+      planfix_frozen_stats(rte->relid, attnum, rte->inh, vardata))
+    return true;
+  if (oldRelationStatsHook)
+    return oldRelationStatsHook(root, rte, attnum, vardata);
+  return false;
+}
+
+static bool planfixIndexStatsHook(PlannerInfo *root, Oid indexOid,
+				  AttrNumber indexattnum,
+				  VariableStatData *vardata)
+{
+  if (planfix_frozen_stats(indexOid, indexattnum, false, vardata))
+    return true;
+  if (oldIndexStatsHook)
+    return oldIndexStatsHook(root, indexOid, indexattnum, vardata);
+  return false;
+}
+
+
+
+/*
+ * Inline hints. A block comment at the start of the query string whose
+ * text begins with "+ planfix" holds hints such as
+ *
+ *   ForceIndex("MyTable" my_gin_idx)
+ *
+ * one per op, the arguments are the names and options of a section of
+ * planfix.forcedindex, separated by blanks or commas. The hints are in
+ * effect while the statement is planned, no SET is needed.
+ *
+ * Only the comments before the first token are scanned, so the cost
+ * does not depend on the length of the query. Comments of other
+ * extensions, e.g. those of pg_hint_plan, are skipped.
+ */
+
+/* skip a block comment starting at p, comments nest like in the lexer */
+static const char* hint_skip_comment(const char *p)
+{
+  int depth = 0;
+
+  while (*p) {
+    if (p[0] == '/' && p[1] == '*') {
+      depth++;
+      p += 2;
+    } else if (p[0] == '*' && p[1] == '/') {
+      p += 2;
+      if (--depth == 0)
+	break;
+    } else {
+      p++;
+    }
+  }
+  return p;
+}
+
+/*
+ * Parse the hints of one planfix comment, p points behind "planfix".
+ * Every hint is appended to value as one section in the syntax of
+ * planfix.forcedindex. Returns the position behind the comment, or
+ * NULL with *problem set.
+ */
+static const char* hint_parse_comment(const char *p, StringInfo value,
+				      char **problem)
+{
+  for (;;) {
+    const char *name;
+    int op;
+
+    while (isspace((unsigned char) *p))
+      p++;
+    if (p[0] == '*' && p[1] == '/')
+      return p + 2;
+    name = p;
+    while (isalnum((unsigned char) *p) || *p == '_')
+      p++;
+    if (p == name) {
+      *problem = psprintf("planfix: syntax error in hint at \"%.20s\"", p);
+      return NULL;
+    }
+    op = planfix_op_lookup(name, p - name);
+    if (op < 0) {
+      *problem = psprintf("planfix: unknown hint \"%.*s\"",
+			  (int) (p - name), name);
+      return NULL;
+    }
+    while (isspace((unsigned char) *p))
+      p++;
+    if (*p++ != '(') {
+      *problem = psprintf("planfix: missing ( after hint %s",
+			  planfixOpNames[op]);
+      return NULL;
+    }
+    if (value->len > 0)
+      appendStringInfoChar(value, ';');
+    appendStringInfo(value, "op=%s", planfixOpNames[op]);
+
+    /* the arguments, quoted names are copied with their quotes */
+    for (;;) {
+      while (isspace((unsigned char) *p) || *p == ',')
+	p++;
+      if (*p == ')') {
+	p++;
+	break;
+      }
+      if (*p == '\0' || (p[0] == '*' && p[1] == '/')) {
+	*problem = psprintf("planfix: missing ) in hint %s",
+			    planfixOpNames[op]);
+	return NULL;
+      }
+      appendStringInfoChar(value, ',');
+      while (*p && !isspace((unsigned char) *p) && *p != ',' && *p != ')' &&
+	     !(p[0] == '*' && p[1] == '/')) {
+	if (*p == '"') {
+	  do {
+	    appendStringInfoChar(value, *p++);
+	    while (*p && *p != '"') {
+	      if (*p == ',' || *p == ';') {
+		*problem = psprintf("planfix: unsupported character %c in hint %s",
+				    *p, planfixOpNames[op]);
+		return NULL;
+	      }
+	      appendStringInfoChar(value, *p++);
+	    }
+	    if (*p == '\0') {
+	      *problem = psprintf("planfix: unterminated name in hint %s",
+				  planfixOpNames[op]);
+	      return NULL;
+	    }
+	    appendStringInfoChar(value, *p++);
+	  } while (*p == '"');	/* "" is a quote in the name */
+	} else if (*p == ';') {
+	  *problem = psprintf("planfix: unsupported character ; in hint %s",
+			      planfixOpNames[op]);
+	  return NULL;
+	} else {
+	  appendStringInfoChar(value, *p++);
+	}
+      }
+    }
+  }
+}
+
+/*
+ * Collect the hints of the leading comments of query into value.
+ * Returns false if there are none or they are malformed, in the latter
+ * case *problem is set.
+ */
+static bool hint_scan(const char *query, StringInfo value, char **problem)
+{
+  const char *p = query;
+
+  *problem = NULL;
+  for (;;) {
+    while (isspace((unsigned char) *p))
+      p++;
+    if (p[0] == '-' && p[1] == '-') {
+      while (*p && *p != '\n')
+	p++;
+    } else if (p[0] == '/' && p[1] == '*') {
+      const char *q = p + 2;
+      if (*q == '+') {
+	q++;
+	while (isspace((unsigned char) *q))
+	  q++;
+	if (pg_strncasecmp(q, "planfix", 7) == 0 &&
+	    (isspace((unsigned char) q[7]) || (q[7] == '*' && q[8] == '/'))) {
+	  p = hint_parse_comment(q + 7, value, problem);
+	  if (p == NULL)
+	    return false;
+	  continue;
+	}
+      }
+      p = hint_skip_comment(p);
+    } else {
+      return value->len > 0;
+    }
+  }
+}
+
+/* whether query may have hints, without collecting them */
+static bool hint_comment_present(const char *query)
+{
+  const char *p = query;
+
+  if (p == NULL)
+    return false;
+  for (;;) {
+    while (isspace((unsigned char) *p))
+      p++;
+    if (p[0] == '-' && p[1] == '-') {
+      while (*p && *p != '\n')
+	p++;
+    } else if (p[0] == '/' && p[1] == '*') {
+      if (p[2] == '+')
+	return true;
+      p = hint_skip_comment(p);
+    } else {
+      return false;
+    }
+  }
+}
+
+/*
+ * Resolve the names of a hint set like directive_set_resolve, but with
+ * an error, e.g. a name with too many dots, reported in *problem
+ * instead of raised. A hint is only a comment, the query must still
+ * run. The names are resolved in a subtransaction for that, except in
+ * parallel mode, where none can be started.
+ */
+static bool hint_set_resolve(PlanfixDirectiveSet *set, char **problem)
+{
+  MemoryContext oldmc = CurrentMemoryContext;
+  ResourceOwner oldowner = CurrentResourceOwner;
+  bool resolved = false;
+
+  if (IsInParallelMode())
+    return directive_set_resolve(set, problem);
+
+  BeginInternalSubTransaction(NULL);
+  MemoryContextSwitchTo(oldmc);
+  PG_TRY();
+  {
+    resolved = directive_set_resolve(set, problem);
+    ReleaseCurrentSubTransaction();
+  }
+  PG_CATCH();
+  {
+    ErrorData *edata;
+
+    MemoryContextSwitchTo(oldmc);
+    edata = CopyErrorData();
+    FlushErrorState();
+    RollbackAndReleaseCurrentSubTransaction();
+    MemoryContextSwitchTo(oldmc);
+    *problem = psprintf("planfix: %s", edata->message);
+    FreeErrorData(edata);
+  }
+  PG_END_TRY();
+  MemoryContextSwitchTo(oldmc);
+  CurrentResourceOwner = oldowner;
+  return resolved;
+}
+
+/*
+ * The set of the hints of query, palloc'd in the current memory-context
+ * or NULL if there are no hints. Resolved sets are shared with the cache
+ * of planfix.forcedindex values, so repeating a hint does not resolve
+ * the names again.
+ */
+static PlanfixDirectiveSet* hint_set_get(const char *query)
+{
+  StringInfoData value;
+  PlanfixDirectiveSet *set;
+  char *problem;
+  char *key;
+
+  if (query == NULL)
+    return NULL;
+  initStringInfo(&value);
+  if (!hint_scan(query, &value, &problem)) {
+    if (problem != NULL)
+      ereport(WARNING,
+	      (errcode(ERRCODE_SYNTAX_ERROR),
+	       errmsg("%s", problem)));
+    pfree(value.data);
+    return NULL;
+  }
+
+  key = directive_cache_key(value.data, PLANFIX_OP_FORCEINDEX);
+  set = directive_cache_lookup(key);
+  if (set != NULL) {
+    PlanfixDirectiveSet *copy = palloc(set->size);
+    memcpy(copy, set, set->size);
+    set = copy;
+  } else {
+    set = directive_set_build(value.data, PLANFIX_OP_FORCEINDEX, &problem);
+    if (set == NULL)
+      ereport(WARNING,
+	      (errcode(ERRCODE_SYNTAX_ERROR),
+	       errmsg("%s", problem)));
+    else if (hint_set_resolve(set, &problem))
+      directive_cache_insert(key, set);
+    else
+      ereport(WARNING,
+	      (errcode(ERRCODE_UNDEFINED_OBJECT),
+	       errmsg("%s", problem)));
+  }
+  pfree(key);
+  pfree(value.data);
+  return set;
+}
+
+
+
+
+/*
+ * Index diet. With planfix.index_diet set, indices whose leading
+ * column is not referenced by the quals, the sort, group, distinct or
+ * window clauses or the aggregates of the query are removed before
+ * any paths are built and costed for them. The restrictions of the
+ * relation are not distributed yet when get_relation_info_hook runs,
+ * so the columns are taken from the (preprocessed) query instead.
+ * Indices on expressions are always kept.
+ */
+typedef struct DietContext_ {
+  Index varno;
+  Bitmapset *attnos;
+} DietContext;
+
+static bool diet_aggref_walker(Node *node, DietContext *context)
+{
+  if (node == NULL || IsA(node, Query))
+    return false;
+  if (IsA(node, Aggref)) {
+    pull_varattnos((Node *) ((Aggref *) node)->args, context->varno,
+		   &context->attnos);
+    return false;
+  }
+  return expression_tree_walker(node, diet_aggref_walker, (void *) context);
+}
+
+static void diet_sortgroup_attnos(List *clauses, List *targetList,
+				  DietContext *context)
+{
+  ListCell *c;
+  foreach (c, clauses) {
+    Node *expr = get_sortgroupclause_expr((SortGroupClause *) lfirst(c),
+					  targetList);
+    pull_varattnos(expr, context->varno, &context->attnos);
+  }
+}
+
+static void planfix_index_diet(PlannerInfo *root, RelOptInfo *rel)
+{
+  Query *parse = root->parse;
+  DietContext context;
+  ListCell *c, *prev, *next;
+
+  /* members of an inheritance tree are not referenced by the query */
+  if (rel->reloptkind != RELOPT_BASEREL || rel->indexlist == NIL)
+    return;
+
+  context.varno = rel->relid;
+  context.attnos = NULL;
+  pull_varattnos((Node *) parse->jointree, rel->relid, &context.attnos);
+  pull_varattnos(parse->havingQual, rel->relid, &context.attnos);
+  pull_varattnos((Node *) root->simple_rte_array[rel->relid]->securityQuals,
+		 rel->relid, &context.attnos);
+  diet_sortgroup_attnos(parse->sortClause, parse->targetList, &context);
+  diet_sortgroup_attnos(parse->groupClause, parse->targetList, &context);
+  diet_sortgroup_attnos(parse->distinctClause, parse->targetList, &context);
+  foreach (c, parse->windowClause) {
+    WindowClause *wc = (WindowClause *) lfirst(c);
+    diet_sortgroup_attnos(wc->partitionClause, parse->targetList, &context);
+    diet_sortgroup_attnos(wc->orderClause, parse->targetList, &context);
+  }
+  if (parse->hasAggs) {
+    diet_aggref_walker((Node *) parse->targetList, &context);
+    diet_aggref_walker(parse->havingQual, &context);
+  }
+
+  prev = NULL;
+  for (c = list_head(rel->indexlist); c != NULL; c = next) {
+    IndexOptInfo *info = (IndexOptInfo *) lfirst(c);
+    int leading = info->indexkeys[0];
+    next = lnext(c);
+    if (leading != 0 &&
+	!bms_is_member(leading - FirstLowInvalidHeapAttributeNumber,
+		       context.attnos)) {
+#ifdef PLANFIX_DEBUG
+      printf(">>  diet removes indexoid=%u\n", info->indexoid);
+#endif
+      rel->indexlist = list_delete_cell(rel->indexlist, c, prev);
+    } else {
+      prev = c;
+    }
+  }
+  bms_free(context.attnos);
+}
+
+
+
+/* resolve a new or invalidated session set again, in place */
+static void directive_set_refresh(PlanfixDirectiveSet *set)
+{
+  char *problem;
+
+  if (set == NULL || set->validated == invalidationCount)
+    return;
+  if (!directive_set_resolve(set, &problem))
+    elog(WARNING, "%s", problem);
+}
+
+/* resolve the sets again if they got stale */
+static void planfix_refresh_sets(void)
+{
+  int i;
+
+  for (i = 0; i < PLANFIX_NUM_OPS; i++)
+    directive_set_refresh(sessionSets[i]);
+  directive_set_refresh(hintSet);
+  planfix_shared_refresh();
+  planfix_table_refresh();
+}
+
+/* the sets in effect, the hints first */
+#define PLANFIX_NUM_SETS (PLANFIX_NUM_OPS + 3)
+
+static void planfix_current_sets(PlanfixDirectiveSet **sets)
+{
+  int i;
+
+  sets[0] = hintSet;
+  for (i = 0; i < PLANFIX_NUM_OPS; i++)
+    sets[1 + i] = sessionSets[i];
+  sets[PLANFIX_NUM_OPS + 1] = sharedSet;
+  sets[PLANFIX_NUM_OPS + 2] = tableSet;
+}
+
+/*
+ * Parameter settings. A set directive names a relation, optionally
+ * further relations, and parameter settings name=value. While a query
+ * using all of its relations is planned, the settings are in effect in
+ * a GUC nest level of their own, which is rolled back afterwards, so
+ * nothing leaks into the session. With scope=execute they are also in
+ * effect while the query runs. Of the conditions only queryid= applies
+ * to them. Settings of hints are made last and so win.
+ */
+
+/* collect the relations of a query, its subqueries and CTEs */
+static bool query_relations_walker(Node *node, List **relations)
+{
+  if (node == NULL)
+    return false;
+  if (IsA(node, RangeTblEntry)) {
+    RangeTblEntry *rte = (RangeTblEntry *) node;
+    if (rte->rtekind == RTE_RELATION)
+      *relations = list_append_unique_oid(*relations, rte->relid);
+    return false;
+  }
+  if (IsA(node, Query))
+    return query_tree_walker((Query *) node, query_relations_walker,
+			     (void *) relations, QTW_EXAMINE_RTES);
+  return expression_tree_walker(node, query_relations_walker,
+				(void *) relations);
+}
+
+static List* planfix_query_relations(Query *parse)
+{
+  List *relations = NIL;
+  query_relations_walker((Node *) parse, &relations);
+  return relations;
+}
+
+/* the relations of a plan, its range table is flat */
+static List* planfix_plan_relations(PlannedStmt *stmt)
+{
+  List *relations = NIL;
+  ListCell *c;
+
+  foreach (c, stmt->rtable) {
+    RangeTblEntry *rte = (RangeTblEntry *) lfirst(c);
+    if (rte->rtekind == RTE_RELATION)
+      relations = list_append_unique_oid(relations, rte->relid);
+  }
+  return relations;
+}
+
+/* make the settings of d, bad ones are reported as a warning */
+static void directive_apply_settings(PlanfixDirectiveSet *set,
+				     PlanfixDirective *d)
+{
+  char *name = SET_PTR(set, d->names);
+  int j;
+
+  for (j = 1; j < d->nnames; j++) {
+    char *setting, *value, *end;
+    name += strlen(name) + 1;
+    if (!directive_name_is_setting(d->op, name))
+      continue;
+    setting = pstrdup(name);
+    value = strchr(setting, '=');
+    *value++ = '\0';
+    for (end = value - 1; end > setting && isspace((unsigned char) end[-1]);
+	 end--)
+      end[-1] = '\0';
+    while (isspace((unsigned char) *value))
+      value++;
+    for (end = value + strlen(value);
+	 end > value && isspace((unsigned char) end[-1]); end--)
+      end[-1] = '\0';
+    while (isspace((unsigned char) *setting))
+      setting++;
+    (void) set_config_option(setting, value,
+			     superuser() ? PGC_SUSET : PGC_USERSET,
+			     PGC_S_SESSION, GUC_ACTION_SAVE, true, WARNING,
+			     false);
+  }
+}
+
+/*
+ * Whether any set directive, with scope=execute if executing, is in
+ * effect. This does not depend on the names being resolved, so it is
+ * checked before the relations of the query are collected at all.
+ */
+static bool planfix_settings_present(bool executing)
+{
+  PlanfixDirectiveSet *sets[PLANFIX_NUM_SETS];
+  int i;
+
+  planfix_current_sets(sets);
+  for (i = 0; i < PLANFIX_NUM_SETS; i++) {
+    if (sets[i] != NULL &&
+	(executing ? sets[i]->nexecute : sets[i]->nsettings) > 0)
+      return true;
+  }
+  return false;
+}
+
+/*
+ * Make the settings of the set directives for a query on relations,
+ * executing for the execute scope. Returns the GUC nest level to end
+ * with planfix_settings_end, -1 if nothing was set.
+ */
+static int planfix_settings_begin(List *relations, uint64 queryId,
+				  bool executing)
+{
+  PlanfixDirectiveSet *sets[PLANFIX_NUM_SETS];
+  int nestLevel = -1;
+  int i;
+
+  if (relations == NIL)
+    return -1;
+  planfix_refresh_sets();
+  planfix_current_sets(sets);
+  for (i = PLANFIX_NUM_SETS - 1; i >= 0; i--) {
+    ListCell *c;
+    foreach (c, relations) {
+      PlanfixDirective *d;
+      for (d = directive_set_lookup(sets[i], lfirst_oid(c)); d != NULL;
+	   d = directive_next(sets[i], d)) {
+	Oid *others = directive_indices(sets[i], d);
+	int j;
+	if (d->op != PLANFIX_OP_SET || (executing && !d->opts.execute) ||
+	    (d->opts.queryId != 0 && d->opts.queryId != queryId))
+	  continue;
+	for (j = 0; j < d->nindices; j++) {
+	  if (!list_member_oid(relations, others[j]))
+	    break;
+	}
+	if (j < d->nindices)
+	  continue;
+	if (nestLevel < 0)
+	  nestLevel = NewGUCNestLevel();
+	directive_apply_settings(sets[i], d);
+	planfix_count(sets[i], d, 0);
+      }
+    }
+  }
+  list_free(relations);
+  return nestLevel;
+}
+
+/* end the settings, keep is false on an error */
+static void planfix_settings_end(int nestLevel, bool keep)
+{
+  if (nestLevel >= 0)
+    AtEOXact_GUC(keep, nestLevel);
+}
+
+/*
+ * Planner hook, remember the queryid and the inline hints of the query
+ * for the directives restricted to a query, and set the parameters of
+ * the set directives for the query. Nested planning restores the outer
+ * ones.
+ */
+static PlannedStmt* planfixPlanner(Query *parse, int cursorOptions,
+				   ParamListInfo boundParams)
+{
+  uint64 savedQueryId = currentQueryId;
+  PlanfixDirectiveSet *savedHintSet = hintSet;
+  List *savedJoinRels = joinRels;
+  PlanfixDirectiveSet *hints;
+  PlannedStmt *result;
+  volatile int nestLevel = -1;
+  double savedPlanfixTime = planfixTime;
+  bool savedTimingActive = timingActive;
+  int savedTimedCounters = ntimedCounters;
+  bool timing = varTrackTiming;
+  instr_time start, planned;
+
+  planfixTime = 0;
+  timingActive = false;
+  ntimedCounters = -1;
+  INSTR_TIME_SET_ZERO(start);
+  if (timing)
+    INSTR_TIME_SET_CURRENT(start);
+  hints = hint_set_get(debug_query_string);
+  currentQueryId = (uint64) parse->queryId;
+  hintSet = hints;
+  joinRels = NIL;
+  PG_TRY();
+  {
+    if (planfix_settings_present(false))
+      nestLevel = planfix_settings_begin(planfix_query_relations(parse),
+					 currentQueryId, false);
+    if (timing) {
+      /* hints and settings are time in planfix as well */
+      INSTR_TIME_SET_CURRENT(planned);
+      INSTR_TIME_SUBTRACT(planned, start);
+      planfixTime += INSTR_TIME_GET_DOUBLE(planned) * 1000000.0;
+    }
+    if (oldPlannerHook)
+      result = oldPlannerHook(parse, cursorOptions, boundParams);
+    else
+      result = standard_planner(parse, cursorOptions, boundParams);
+  }
+  PG_CATCH();
+  {
+    planfix_settings_end(nestLevel, false);
+    currentQueryId = savedQueryId;
+    hintSet = savedHintSet;
+    joinRels = savedJoinRels;
+    planfixTime = savedPlanfixTime;
+    timingActive = savedTimingActive;
+    ntimedCounters = savedTimedCounters;
+    PG_RE_THROW();
+  }
+  PG_END_TRY();
+  planfix_settings_end(nestLevel, true);
+  currentQueryId = savedQueryId;
+  hintSet = savedHintSet;
+  list_free_deep(joinRels);
+  joinRels = savedJoinRels;
+  if (hints != NULL)
+    pfree(hints);
+  if (timing) {
+    INSTR_TIME_SET_CURRENT(planned);
+    INSTR_TIME_SUBTRACT(planned, start);
+    planfix_timing_record(PLANFIX_TIMING_PLANFIX, planfixTime);
+    planfix_timing_record(PLANFIX_TIMING_PLANNING,
+			  INSTR_TIME_GET_DOUBLE(planned) * 1000000.0);
+  }
+  /* a nested statement is part of the outer one */
+  planfixTime += savedPlanfixTime;
+  timingActive = savedTimingActive;
+  ntimedCounters = savedTimedCounters;
+  return result;
+}
+
+/*
+ * Executor hook, keep the settings of the set directives with
+ * scope=execute while the query runs. Without such a directive, and
+ * without a hint comment that could hold one, the query is run right
+ * away.
+ */
+static void planfixExecutorRun(QueryDesc *queryDesc, ScanDirection direction,
+			       uint64 count)
+{
+  PlanfixDirectiveSet *savedHintSet = hintSet;
+  PlanfixDirectiveSet *hints = NULL;
+  volatile int nestLevel = -1;
+
+  if (!planfix_settings_present(true) &&
+      !hint_comment_present(debug_query_string)) {
+    if (oldExecutorRunHook)
+      oldExecutorRunHook(queryDesc, direction, count);
+    else
+      standard_ExecutorRun(queryDesc, direction, count);
+    return;
+  }
+
+  hints = hint_set_get(debug_query_string);
+  hintSet = hints;
+  PG_TRY();
+  {
+    if (planfix_settings_present(true))
+      nestLevel = planfix_settings_begin(
+	  planfix_plan_relations(queryDesc->plannedstmt),
+	  (uint64) queryDesc->plannedstmt->queryId, true);
+    hintSet = savedHintSet;
+    if (oldExecutorRunHook)
+      oldExecutorRunHook(queryDesc, direction, count);
+    else
+      standard_ExecutorRun(queryDesc, direction, count);
+  }
+  PG_CATCH();
+  {
+    planfix_settings_end(nestLevel, false);
+    hintSet = savedHintSet;
+    PG_RE_THROW();
+  }
+  PG_END_TRY();
+  planfix_settings_end(nestLevel, true);
+  if (hints != NULL)
+    pfree(hints);
+}
+
+/*
+ * Operator conditions. The restrictions of a relation are only
+ * distributed after get_relation_info_hook ran, so the quals of the
+ * query are searched for an operator clause on the relation instead.
+ * This only happens for relations with such a directive.
+ */
+typedef struct OperatorContext_ {
+  Relids relids;
+  const char *name;
+} OperatorContext;
+
+static bool operator_clause_walker(Node *node, OperatorContext *context)
+{
+  if (node == NULL || IsA(node, Query))
+    return false;
+  if (IsA(node, OpExpr) || IsA(node, ScalarArrayOpExpr)) {
+    Oid opno;
+    List *args;
+    if (IsA(node, OpExpr)) {
+      opno = ((OpExpr *) node)->opno;
+      args = ((OpExpr *) node)->args;
+    } else {
+      opno = ((ScalarArrayOpExpr *) node)->opno;
+      args = ((ScalarArrayOpExpr *) node)->args;
+    }
+    if (bms_overlap(context->relids, pull_varnos((Node *) args))) {
+      char *name = get_opname(opno);
+      bool match = (name != NULL && strcmp(name, context->name) == 0);
+      if (name != NULL)
+	pfree(name);
+      if (match)
+	return true;
+    }
+  }
+  return expression_tree_walker(node, operator_clause_walker,
+				(void *) context);
+}
+
+/*
+ * Whether a condition of the query on one of the relations of rel, a
+ * base or a join rel, uses an operator of that name.
+ */
+static bool rel_uses_operator(PlannerInfo *root, RelOptInfo *rel,
+			      const char *name)
+{
+  OperatorContext context;
+
+  context.relids = rel->relids;
+  context.name = name;
+  return operator_clause_walker((Node *) root->parse->jointree, &context);
+}
+
+/*
+ * LIMIT plus OFFSET of the query, or -1 without a LIMIT or if one of them
+ * is not a constant. root->limit_tuples can not be used, it is -1 as well
+ * for queries with grouping, aggregates or window functions, where the
+ * LIMIT does not limit the rows of the scans.
+ */
+static double query_limit(Query *parse)
+{
+  Const *count = (Const *) parse->limitCount;
+  Const *offset = (Const *) parse->limitOffset;
+  double limit;
+
+  if (count == NULL || !IsA(count, Const) || count->constisnull)
+    return -1;
+  limit = Max((double) DatumGetInt64(count->constvalue), 0);
+  if (offset != NULL) {
+    if (!IsA(offset, Const))
+      return -1;
+    if (!offset->constisnull)
+      limit += Max((double) DatumGetInt64(offset->constvalue), 0);
+  }
+  return limit;
+}
+
+/* do the conditions of a directive for the relation hold */
+static bool directive_applies(PlannerInfo *root, RelOptInfo *rel,
+			      PlanfixDirective *d)
+{
+  if (d->opts.queryId != 0 && d->opts.queryId != currentQueryId)
+    return false;
+  if (d->opts.limitMin > 0 || d->opts.limitBelow > 0) {
+    double limit = query_limit(root->parse);
+    if (limit < 0)
+      return d->opts.limitBelow == 0;
+    if (d->opts.limitMin > 0 && limit < (double) d->opts.limitMin)
+      return false;
+    if (d->opts.limitBelow > 0 && limit >= (double) d->opts.limitBelow)
+      return false;
+  }
+  if (d->opts.operName[0] != '\0' &&
+      !rel_uses_operator(root, rel, d->opts.operName))
+    return false;
+  return true;
+}
+
+/*
+ * EXPLAIN. While a query is planned for EXPLAIN, the indices a
+ * directive pruned from a relation are recorded, and printed after the
+ * plan as
+ *
+ *   Planfix: pruned idx_a, idx_b on orders (planfix.forcedindex #3)
+ *
+ * naming the source of the directive and its number there. Outside of
+ * EXPLAIN this costs a test of explainActive.
+ */
+typedef struct PlanfixPruned_ {
+  Oid relation;
+  List *indices;		/* oids of the pruned indices */
+  const char *source;
+  int number;			/* of the directive in its source, from 1 */
+} PlanfixPruned;
+
+/* the name of the source of a set */
+static const char* planfix_set_source(PlanfixDirectiveSet *set)
+{
+  static const char *const gucNames[] = {
+    "planfix.forcedindex",
+    "planfix.disabledindex",
+    "planfix.preferredindex"
+  };
+  int i;
+
+  if (set == hintSet)
+    return "hints";
+  if (set == sharedSet)
+    return "shared directives";
+  if (set == tableSet)
+    return "planfix_directive";
+  for (i = 0; i < PLANFIX_NUM_OPS; i++) {
+    if (set == sessionSets[i])
+      return (i < lengthof(gucNames) ? gucNames[i] :
+	      psprintf("planfix.%s", planfixOpNames[i]));
+  }
+  return "unknown";
+}
+
+/* record the indices of before that d pruned, leaving after */
+static void planfix_explain_record(PlanfixDirectiveSet *set,
+				   PlanfixDirective *d, Oid relation,
+				   List *before, List *after)
+{
+  PlanfixPruned *pruned;
+  const char *source = planfix_set_source(set);
+  int number = (int) (d - set->directives) + 1;
+  ListCell *c;
+
+  /* a relation planned twice, e.g. in a subquery, is reported once */
+  foreach (c, explainPruned) {
+    pruned = (PlanfixPruned *) lfirst(c);
+    if (pruned->relation == relation && pruned->number == number &&
+	strcmp(pruned->source, source) == 0)
+      return;
+  }
+  pruned = palloc(sizeof(PlanfixPruned));
+  pruned->relation = relation;
+  pruned->indices = NIL;
+  pruned->source = source;
+  pruned->number = number;
+  foreach (c, before) {
+    if (!list_member_ptr(after, lfirst(c)))
+      pruned->indices = lappend_oid(pruned->indices,
+				    ((IndexOptInfo *) lfirst(c))->indexoid);
+  }
+  explainPruned = lappend(explainPruned, pruned);
+}
+
+/* print the recorded prunings, in the text format only */
+static void planfix_explain_print(ExplainState *es)
+{
+  ListCell *c, *c2;
+
+  if (es->format != EXPLAIN_FORMAT_TEXT)
+    return;
+  foreach (c, explainPruned) {
+    PlanfixPruned *pruned = (PlanfixPruned *) lfirst(c);
+    appendStringInfoSpaces(es->str, es->indent * 2);
+    appendStringInfoString(es->str, "Planfix: pruned ");
+    foreach (c2, pruned->indices) {
+      if (c2 != list_head(pruned->indices))
+	appendStringInfoString(es->str, ", ");
+      appendStringInfoString(es->str, get_rel_name(lfirst_oid(c2)));
+    }
+    appendStringInfo(es->str, " on %s (%s #%d)\n",
+		     get_rel_name(pruned->relation), pruned->source,
+		     pruned->number);
+  }
+}
+
+/*
+ * EXPLAIN hook, plan as ExplainOneQuery does with pruned indices being
+ * recorded, then print them after the plan.
+ */
+static void planfixExplainOneQuery(Query *query, IntoClause *into,
+				   ExplainState *es, const char *queryString,
+				   ParamListInfo params)
+{
+  bool savedExplainActive = explainActive;
+  List *savedExplainPruned = explainPruned;
+
+  explainActive = true;
+  explainPruned = NIL;
+  PG_TRY();
+  {
+    if (oldExplainOneQueryHook)
+      oldExplainOneQueryHook(query, into, es, queryString, params);
+    else {
+      PlannedStmt *plan;
+      instr_time planstart, planduration;
+
+      INSTR_TIME_SET_CURRENT(planstart);
+      plan = pg_plan_query(query, into ? 0 : CURSOR_OPT_PARALLEL_OK, params);
+      INSTR_TIME_SET_CURRENT(planduration);
+      INSTR_TIME_SUBTRACT(planduration, planstart);
+
+      /* executing the plan must not record */
+      explainActive = savedExplainActive;
+      ExplainOnePlan(plan, into, es, queryString, params, &planduration);
+    }
+    planfix_explain_print(es);
+  }
+  PG_CATCH();
+  {
+    explainActive = savedExplainActive;
+    explainPruned = savedExplainPruned;
+    PG_RE_THROW();
+  }
+  PG_END_TRY();
+  explainActive = savedExplainActive;
+  explainPruned = savedExplainPruned;
+}
+
+/* apply the directives of set for the relation */
+static void planfix_apply_set(PlanfixDirectiveSet *set, PlannerInfo *root,
+			      Oid relationObjectId, RelOptInfo *rel)
+{
+  PlanfixDirective *d;
+
+  for (d = directive_set_lookup(set, relationObjectId); d != NULL;
+       d = directive_next(set, d)) {
+    if (!directive_applies(root, rel, d))
+      continue;
+    if ((d->op == PLANFIX_OP_FORCEINDEX || d->op == PLANFIX_OP_DISABLEINDEX)
+	&& d->nindices > 0) {
+      bool keep = (d->op == PLANFIX_OP_FORCEINDEX);
+      int before = list_length(rel->indexlist);
+      List *indexlist = (explainActive ? list_copy(rel->indexlist) : NIL);
+      ListCell *c2, *prev, *next;
+#ifdef PLANFIX_DEBUG
+      printf(">> checking rel %s\n", get_rel_name(relationObjectId));
+#endif
+      /*
+       * The relation was verified to be a plain table when the directive
+       * was resolved. Filter the indexlist in place in a single pass.
+       */
+      prev = NULL;
+      for (c2 = list_head(rel->indexlist); c2 != NULL; c2 = next) {
+	IndexOptInfo *info = (IndexOptInfo *)lfirst(c2);
+	bool allowed = (directive_has_index(set, d, info->indexoid) == keep);
+	next = lnext(c2);
+#ifdef PLANFIX_DEBUG
+	printf(">>  allowed=%d for indexoid=%u\n", allowed, info->indexoid);
+#endif
+	if (!allowed)
+	  rel->indexlist = list_delete_cell(rel->indexlist, c2, prev);
+	else
+	  prev = c2;
+      }
+      planfix_count(set, d, before - list_length(rel->indexlist));
+      if (explainActive && list_length(rel->indexlist) < before)
+	planfix_explain_record(set, d, relationObjectId, indexlist,
+			       rel->indexlist);
+      list_free(indexlist);
+    }
+  }
+}
+
+/*
+ * Parallel workers. The first parallelworkers directive of the relation
+ * that applies replaces the parallel_workers reloption, hints coming
+ * before the session, shared and table directives. The planner still
+ * caps the workers by max_parallel_workers_per_gather.
+ */
+static void planfix_parallel_workers(PlanfixDirectiveSet **sets,
+				     PlannerInfo *root, Oid relationObjectId,
+				     RelOptInfo *rel)
+{
+  int i;
+
+  for (i = 0; i < PLANFIX_NUM_SETS; i++) {
+    PlanfixDirective *d;
+    for (d = directive_set_lookup(sets[i], relationObjectId); d != NULL;
+	 d = directive_next(sets[i], d)) {
+      if (d->op == PLANFIX_OP_PARALLELWORKERS && d->opts.workersGiven &&
+	  directive_applies(root, rel, d)) {
+	rel->rel_parallel_workers = d->opts.workers;
+	planfix_count(sets[i], d, 0);
+	return;
+      }
+    }
+  }
+}
+
+/* 
+ * Planner hook, probe the session, shared and table directives for the
+ * relation. Relations without directives cost a single hash lookup
+ * per set, only the directives for a matched relation are looked at.
+ */
+static void planfixHook(PlannerInfo *root, Oid relationObjectId, bool inhparent,
+			RelOptInfo *rel) 
+{
+  PlanfixDirectiveSet *sets[PLANFIX_NUM_SETS];
+  instr_time start;
+  int i;
+
+  planfix_timing_start(&start);
+  planfix_refresh_sets();
+  planfix_current_sets(sets);
+  for (i = 0; i < PLANFIX_NUM_SETS; i++)
+    planfix_apply_set(sets[i], root, relationObjectId, rel);
+  planfix_parallel_workers(sets, root, relationObjectId, rel);
+  planfix_frozen_sizes(relationObjectId, rel);
+
+  if (varIndexDiet)
+    planfix_index_diet(root, rel);
+  planfix_timing_end(&start);
+
+  if (oldHook)
+    oldHook(root, relationObjectId, inhparent, rel);
+}
+
+
+
+/*
+ * Row estimates. A rows directive of a single relation adjusts the
+ * estimate of the base relation once its paths are built, one naming
+ * several relations that of their join. The rows of the paths built so
+ * far are scaled along, paths built later take the new estimate.
+ */
+static double directive_rows(PlanfixDirective *d, double rows)
+{
+  if (d->opts.rows > 0)
+    rows = d->opts.rows;
+  if (d->opts.rowsFactor > 0)
+    rows *= d->opts.rowsFactor;
+  if (d->opts.rowsMin > 0)
+    rows = Max(rows, d->opts.rowsMin);
+  if (d->opts.rowsMax > 0)
+    rows = Min(rows, d->opts.rowsMax);
+  return clamp_row_est(rows);
+}
+
+static void planfix_scale_rows(List *paths, double factor)
+{
+  ListCell *c;
+  foreach (c, paths) {
+    Path *path = (Path *) lfirst(c);
+    path->rows = clamp_row_est(path->rows * factor);
+  }
+}
+
+static void planfix_set_rows(RelOptInfo *rel, double rows)
+{
+  double factor = (rel->rows > 0 ? rows / rel->rows : 1.0);
+
+  planfix_scale_rows(rel->pathlist, factor);
+  planfix_scale_rows(rel->partial_pathlist, factor);
+  rel->rows = rows;
+}
+
+
+
+/*
+ * Preferred indices. The paths of a relation with preferindex
+ * directives that do not use one of the indices get their cost
+ * multiplied by planfix.prefer_penalty, so they only win if the
+ * preferred indices cannot serve the query. As add_path may already
+ * have rejected the paths of the preferred indices in favour of the
+ * now penalized ones, those paths are built again afterwards.
+ */
+static bool path_uses_index(Path *path, Oid *indices, int nindices)
+{
+  ListCell *c;
+
+  switch (nodeTag(path)) {
+  case T_IndexPath:
+    return oids_contain(indices, nindices,
+			((IndexPath *) path)->indexinfo->indexoid);
+  case T_BitmapHeapPath:
+    return path_uses_index(((BitmapHeapPath *) path)->bitmapqual,
+			   indices, nindices);
+  case T_BitmapAndPath:
+    foreach (c, ((BitmapAndPath *) path)->bitmapquals) {
+      if (path_uses_index((Path *) lfirst(c), indices, nindices))
+	return true;
+    }
+    return false;
+  case T_BitmapOrPath:
+    foreach (c, ((BitmapOrPath *) path)->bitmapquals) {
+      if (path_uses_index((Path *) lfirst(c), indices, nindices))
+	return true;
+    }
+    return false;
+  case T_GatherPath:
+    return path_uses_index(((GatherPath *) path)->subpath, indices, nindices);
+  default:
+    return false;
+  }
+}
+
+static void planfix_penalize_paths(List *paths, Oid *indices, int nindices)
+{
+  ListCell *c;
+  foreach (c, paths) {
+    Path *path = (Path *) lfirst(c);
+    if (!path_uses_index(path, indices, nindices)) {
+      path->startup_cost *= varPreferPenalty;
+      path->total_cost *= varPreferPenalty;
+    }
+  }
+}
+
+/*
+ * Build the index paths of rel again, only for the given indices if
+ * there are any.
+ */
+static void planfix_index_paths(PlannerInfo *root, RelOptInfo *rel,
+				Oid *indices, int nindices)
+{
+  List *indexlist = rel->indexlist;
+  List *selected = NIL;
+  ListCell *c;
+
+  if (nindices == 0) {
+    create_index_paths(root, rel);
+    return;
+  }
+  foreach (c, indexlist) {
+    IndexOptInfo *info = (IndexOptInfo *) lfirst(c);
+    if (oids_contain(indices, nindices, info->indexoid))
+      selected = lappend(selected, info);
+  }
+  if (selected == NIL)
+    return;
+
+  rel->indexlist = selected;
+  PG_TRY();
+  {
+    create_index_paths(root, rel);
+  }
+  PG_CATCH();
+  {
+    rel->indexlist = indexlist;
+    PG_RE_THROW();
+  }
+  PG_END_TRY();
+  rel->indexlist = indexlist;
+  list_free(selected);
+}
+
+/*
+ * Scan types. A seqscan, indexscan, indexonlyscan or bitmapscan
+ * directive keeps only the paths of the relation of that type, and if
+ * it names indices only those using one of them. The paths of the type
+ * are built again first with only that type enabled, as add_path may
+ * have dropped them, and an index only scan is built instead of an
+ * index scan where possible. If no path of the type without parameters
+ * results, all paths are kept.
+ */
+static bool path_has_scantype(Path *path, PlanfixDirectiveSet *set,
+			      PlanfixDirective *d)
+{
+  switch (d->op) {
+  case PLANFIX_OP_SEQSCAN:
+    return IsA(path, Path) && path->pathtype == T_SeqScan;
+  case PLANFIX_OP_INDEXSCAN:
+    if (!IsA(path, IndexPath) || path->pathtype != T_IndexScan)
+      return false;
+    break;
+  case PLANFIX_OP_INDEXONLYSCAN:
+    if (!IsA(path, IndexPath) || path->pathtype != T_IndexOnlyScan)
+      return false;
+    break;
+  case PLANFIX_OP_BITMAPSCAN:
+    if (!IsA(path, BitmapHeapPath))
+      return false;
+    break;
+  default:
+    return false;
+  }
+  return d->nindices == 0 ||
+    path_uses_index(path, directive_indices(set, d), d->nindices);
+}
+
+static List* planfix_filter_scans(List *paths, PlanfixDirectiveSet *set,
+				  PlanfixDirective *d, bool *unparameterized)
+{
+  List *kept = NIL;
+  ListCell *c;
+
+  foreach (c, paths) {
+    Path *path = (Path *) lfirst(c);
+    Path *scan = path;
+    /* a Gather of a parallel scan of the type is such a scan as well */
+    if (IsA(path, GatherPath))
+      scan = ((GatherPath *) path)->subpath;
+    if (path_has_scantype(scan, set, d)) {
+      kept = lappend(kept, path);
+      if (path->param_info == NULL)
+	*unparameterized = true;
+    }
+  }
+  return kept;
+}
+
+static void planfix_scan_type(PlannerInfo *root, RelOptInfo *rel,
+			      PlanfixDirectiveSet *set, PlanfixDirective *d)
+{
+  bool savedIndexScan = enable_indexscan;
+  bool savedIndexOnlyScan = enable_indexonlyscan;
+  bool savedBitmapScan = enable_bitmapscan;
+  bool unparameterized = false, partial = false;
+  List *pathlist;
+
+  if (d->op == PLANFIX_OP_SEQSCAN) {
+    add_path(rel, create_seqscan_path(root, rel, NULL, 0));
+  } else if (rel->indexlist != NIL) {
+    enable_indexscan = (d->op != PLANFIX_OP_BITMAPSCAN);
+    enable_indexonlyscan = (d->op == PLANFIX_OP_INDEXONLYSCAN);
+    enable_bitmapscan = (d->op == PLANFIX_OP_BITMAPSCAN);
+    PG_TRY();
+    {
+      planfix_index_paths(root, rel, directive_indices(set, d), d->nindices);
+    }
+    PG_CATCH();
+    {
+      enable_indexscan = savedIndexScan;
+      enable_indexonlyscan = savedIndexOnlyScan;
+      enable_bitmapscan = savedBitmapScan;
+      PG_RE_THROW();
+    }
+    PG_END_TRY();
+    enable_indexscan = savedIndexScan;
+    enable_indexonlyscan = savedIndexOnlyScan;
+    enable_bitmapscan = savedBitmapScan;
+  }
+
+  pathlist = planfix_filter_scans(rel->pathlist, set, d, &unparameterized);
+  if (!unparameterized) {
+    list_free(pathlist);
+    return;
+  }
+  rel->pathlist = pathlist;
+  rel->partial_pathlist = planfix_filter_scans(rel->partial_pathlist, set, d,
+					       &partial);
+}
+
+static void planfix_rel_pathlist(PlannerInfo *root, RelOptInfo *rel,
+				 RangeTblEntry *rte)
+{
+  PlanfixDirectiveSet *sets[PLANFIX_NUM_SETS];
+  PlanfixDirectiveSet *scanSet = NULL, *rowsSet = NULL;
+  PlanfixDirective *scan = NULL, *rows = NULL;
+  Oid *indices = NULL;
+  int nindices = 0, i;
+  bool plain;
+
+  if (rte->rtekind != RTE_RELATION)
+    return;
+  /*
+   * The paths of an inheritance parent append its children and those of
+   * a TABLESAMPLE relation sample it, so no scan of the relation itself
+   * may be built or kept instead for them.
+   */
+  plain = !rte->inh && rte->tablesample == NULL;
+
+  planfix_current_sets(sets);
+  for (i = 0; i < PLANFIX_NUM_SETS; i++) {
+    PlanfixDirective *d;
+    for (d = directive_set_lookup(sets[i], rte->relid); d != NULL;
+	 d = directive_next(sets[i], d)) {
+      if (d->op == PLANFIX_OP_ROWS && d->nindices == 0 && rows == NULL &&
+	  directive_applies(root, rel, d)) {
+	rows = d;
+	rowsSet = sets[i];
+      } else if (plain && planfix_op_is_scan(d->op) && scan == NULL &&
+	       directive_applies(root, rel, d)) {
+	scan = d;
+	scanSet = sets[i];
+      }
+    }
+  }
+  if (rows != NULL) {
+    planfix_set_rows(rel, directive_rows(rows, rel->rows));
+    planfix_count(rowsSet, rows, 0);
+  }
+  if (scan != NULL) {
+    planfix_scan_type(root, rel, scanSet, scan);
+    planfix_count(scanSet, scan, 0);
+  }
+
+  if (!plain || rel->indexlist == NIL)
+    return;
+  for (i = 0; i < PLANFIX_NUM_SETS; i++) {
+    PlanfixDirective *d;
+    for (d = directive_set_lookup(sets[i], rte->relid); d != NULL;
+	 d = directive_next(sets[i], d)) {
+      if (d->op != PLANFIX_OP_PREFERINDEX || d->nindices == 0 ||
+	  !directive_applies(root, rel, d))
+	continue;
+      if (indices == NULL)
+	indices = palloc(sizeof(Oid) * d->nindices);
+      else
+	indices = repalloc(indices, sizeof(Oid) * (nindices + d->nindices));
+      memcpy(indices + nindices, directive_indices(sets[i], d),
+	     sizeof(Oid) * d->nindices);
+      planfix_count(sets[i], d, 0);
+      nindices += d->nindices;
+    }
+  }
+  if (nindices == 0)
+    return;
+  nindices = oids_sort_unique(indices, nindices);
+
+  planfix_penalize_paths(rel->pathlist, indices, nindices);
+  planfix_penalize_paths(rel->partial_pathlist, indices, nindices);
+
+  /* build the paths of the preferred indices again */
+  planfix_index_paths(root, rel, indices, nindices);
+  pfree(indices);
+}
+
+static void planfixPathlistHook(PlannerInfo *root, RelOptInfo *rel,
+				Index rti, RangeTblEntry *rte)
+{
+  instr_time start;
+
+  if (oldPathlistHook)
+    oldPathlistHook(root, rel, rti, rte);
+
+  planfix_timing_start(&start);
+  planfix_rel_pathlist(root, rel, rte);
+  planfix_timing_end(&start);
+}
+
+
+
+/*
+ * Join methods. A nestloop, hashjoin or mergejoin directive names all
+ * relations of a join, it applies to the join of exactly these
+ * relations, whatever the order. The paths of the join using another
+ * method get disable_cost added, then the paths of the method are
+ * built again with only that method enabled, as add_path may already
+ * have dropped them in favour of the now penalized paths. If the
+ * method cannot implement the join, the penalized paths remain.
+ */
+static bool joinHookActive = false;
+
+/* does d name exactly the relations oids, sorted and unique */
+static bool directive_joins(PlanfixDirectiveSet *set, PlanfixDirective *d,
+			    Oid *oids, int n)
+{
+  int nrels = d->nindices;
+  int i;
+
+  if (!directive_has_index(set, d, d->relation))
+    nrels++;
+  if (nrels != n)
+    return false;
+  for (i = 0; i < n; i++) {
+    if (oids[i] != d->relation && !directive_has_index(set, d, oids[i]))
+      return false;
+  }
+  return true;
+}
+
+/*
+ * The first directive with an op from first to last naming exactly
+ * the relations of joinrel, or NULL. It is counted if count is set.
+ */
+static PlanfixDirective* planfix_join_directive(PlannerInfo *root,
+						RelOptInfo *joinrel,
+						PlanfixOp first,
+						PlanfixOp last,
+						bool count)
+{
+  PlanfixDirectiveSet *sets[PLANFIX_NUM_SETS];
+  PlanfixDirective *found = NULL;
+  Oid *oids;
+  int n = 0, x = -1, i, j;
+
+  oids = palloc(sizeof(Oid) * bms_num_members(joinrel->relids));
+  while ((x = bms_next_member(joinrel->relids, x)) >= 0) {
+    RangeTblEntry *rte = root->simple_rte_array[x];
+    if (rte->rtekind != RTE_RELATION) {
+      pfree(oids);
+      return NULL;
+    }
+    oids[n++] = rte->relid;
+  }
+  n = oids_sort_unique(oids, n);
+
+  planfix_current_sets(sets);
+  for (i = 0; i < PLANFIX_NUM_SETS && found == NULL; i++) {
+    for (j = 0; j < n && found == NULL; j++) {
+      PlanfixDirective *d;
+      for (d = directive_set_lookup(sets[i], oids[j]); d != NULL;
+	   d = directive_next(sets[i], d)) {
+	if (d->op >= first && d->op <= last && d->nindices > 0 &&
+	    directive_joins(sets[i], d, oids, n) &&
+	    directive_applies(root, joinrel, d)) {
+	  if (count)
+	    planfix_count(sets[i], d, 0);
+	  found = d;
+	  break;
+	}
+      }
+    }
+  }
+  pfree(oids);
+  return found;
+}
+
+/* the entry of the join rel of relids, or NULL */
+static PlanfixJoinRel* planfix_join_rel(PlannerInfo *root, Relids relids)
+{
+  ListCell *c;
+
+  foreach (c, joinRels) {
+    PlanfixJoinRel *joined = (PlanfixJoinRel *) lfirst(c);
+    if (joined->root == root && bms_equal(joined->relids, relids))
+      return joined;
+  }
+  return NULL;
+}
+
+static PlanfixJoinRel* planfix_join_rel_add(PlannerInfo *root,
+					    Relids relids)
+{
+  MemoryContext oldmc = MemoryContextSwitchTo(root->planner_cxt);
+  PlanfixJoinRel *joined = palloc(sizeof(PlanfixJoinRel));
+
+  joined->root = root;
+  joined->relids = bms_copy(relids);
+  joined->rows = -1;
+  joinRels = lappend(joinRels, joined);
+  MemoryContextSwitchTo(oldmc);
+  return joined;
+}
+
+static void planfix_penalize_joins(List *paths, int method)
+{
+  static const NodeTag methodTags[] = {T_NestPath, T_HashPath, T_MergePath};
+  NodeTag allowed = methodTags[method - PLANFIX_OP_NESTLOOP];
+  ListCell *c;
+
+  foreach (c, paths) {
+    Path *path = (Path *) lfirst(c);
+    NodeTag tag = nodeTag(path);
+    if ((tag == T_NestPath || tag == T_HashPath || tag == T_MergePath) &&
+	tag != allowed && path->total_cost < disable_cost) {
+      path->startup_cost += disable_cost;
+      path->total_cost += disable_cost;
+    }
+  }
+}
+
+static void planfix_join_pathlist(PlannerInfo *root, RelOptInfo *joinrel,
+				  RelOptInfo *outerrel, RelOptInfo *innerrel,
+				  JoinType jointype, JoinPathExtraData *extra)
+{
+  bool savedNestLoop = enable_nestloop;
+  bool savedHashJoin = enable_hashjoin;
+  bool savedMergeJoin = enable_mergejoin;
+  PlanfixJoinRel *joined;
+  PlanfixDirective *d;
+  bool first;
+  int method;
+
+  /*
+   * Whether a directive applies depends on the join rel only, so one
+   * that applies does so on the first call for the join rel already,
+   * where the entry is made and it is counted. The estimate of a join
+   * rel is only adjusted once. A join rel of the same relations built
+   * again by GEQO still has the estimate of the planner, unless that
+   * happens to be the adjusted one.
+   */
+  joined = planfix_join_rel(root, joinrel->relids);
+  first = (joined == NULL);
+  if (first || (joined->rows >= 0 && joined->rows != joinrel->rows)) {
+    d = planfix_join_directive(root, joinrel, PLANFIX_OP_ROWS,
+			       PLANFIX_OP_ROWS, first);
+    if (d != NULL) {
+      planfix_set_rows(joinrel, directive_rows(d, joinrel->rows));
+      if (joined == NULL)
+	joined = planfix_join_rel_add(root, joinrel->relids);
+      joined->rows = joinrel->rows;
+    }
+  }
+
+  d = planfix_join_directive(root, joinrel, PLANFIX_OP_NESTLOOP,
+			     PLANFIX_OP_MERGEJOIN, first);
+  if (d == NULL)
+    return;
+  method = d->op;
+  if (joined == NULL)
+    planfix_join_rel_add(root, joinrel->relids);
+
+  planfix_penalize_joins(joinrel->pathlist, method);
+  planfix_penalize_joins(joinrel->partial_pathlist, method);
+
+  joinHookActive = true;
+  enable_nestloop = (method == PLANFIX_OP_NESTLOOP);
+  enable_hashjoin = (method == PLANFIX_OP_HASHJOIN);
+  enable_mergejoin = (method == PLANFIX_OP_MERGEJOIN);
+  PG_TRY();
+  {
+    add_paths_to_joinrel(root, joinrel, outerrel, innerrel, jointype,
+			 extra->sjinfo, extra->restrictlist);
+  }
+  PG_CATCH();
+  {
+    enable_nestloop = savedNestLoop;
+    enable_hashjoin = savedHashJoin;
+    enable_mergejoin = savedMergeJoin;
+    joinHookActive = false;
+    PG_RE_THROW();
+  }
+  PG_END_TRY();
+  enable_nestloop = savedNestLoop;
+  enable_hashjoin = savedHashJoin;
+  enable_mergejoin = savedMergeJoin;
+  joinHookActive = false;
+}
+
+static void planfixJoinPathlistHook(PlannerInfo *root, RelOptInfo *joinrel,
+				    RelOptInfo *outerrel, RelOptInfo *innerrel,
+				    JoinType jointype,
+				    JoinPathExtraData *extra)
+{
+  instr_time start;
+
+  if (oldJoinPathlistHook)
+    oldJoinPathlistHook(root, joinrel, outerrel, innerrel, jointype, extra);
+
+  /* the paths built again by planfix_join_pathlist pass this hook too */
+  if (joinHookActive)
+    return;
+
+  planfix_timing_start(&start);
+  planfix_join_pathlist(root, joinrel, outerrel, innerrel, jointype, extra);
+  planfix_timing_end(&start);
+}
+
+
+
+/*
+ * Leading, the relations of a leading directive are joined first, in
+ * the order given, as a left-deep tree built directly by make_join_rel.
+ * If they are all relations of the join problem, no join search runs
+ * at all. Otherwise the joined relations take the place of the leading
+ * relations in the join search for the rest. If the order is not a
+ * legal join order, e.g. because of outer joins, the join rels built
+ * are forgotten and the join search runs as usual.
+ */
+static RelOptInfo* planfix_join_search_default(PlannerInfo *root,
+					       int levels_needed,
+					       List *initial_rels)
+{
+  if (oldJoinSearchHook)
+    return oldJoinSearchHook(root, levels_needed, initial_rels);
+  if (enable_geqo && levels_needed >= geqo_threshold)
+    return geqo(root, levels_needed, initial_rels);
+  return standard_join_search(root, levels_needed, initial_rels);
+}
+
+/* the initial rel of the base relation relid, or NULL */
+static RelOptInfo* leading_find_rel(PlannerInfo *root, List *initial_rels,
+				    Oid relid)
+{
+  ListCell *c;
+  foreach (c, initial_rels) {
+    RelOptInfo *rel = (RelOptInfo *) lfirst(c);
+    if (rel->reloptkind == RELOPT_BASEREL &&
+	root->simple_rte_array[rel->relid]->rtekind == RTE_RELATION &&
+	root->simple_rte_array[rel->relid]->relid == relid)
+      return rel;
+  }
+  return NULL;
+}
+
+/* drop the join rels built since there were nrels */
+static void leading_forget_joinrels(PlannerInfo *root, int nrels)
+{
+  while (list_length(root->join_rel_list) > nrels) {
+    RelOptInfo *rel = (RelOptInfo *) llast(root->join_rel_list);
+    if (root->join_rel_hash)
+      hash_search(root->join_rel_hash, &rel->relids, HASH_REMOVE, NULL);
+    root->join_rel_list = list_truncate(root->join_rel_list,
+					list_length(root->join_rel_list) - 1);
+  }
+}
+
+/*
+ * Join the relations of d, the initial rels used are returned in
+ * *used. Returns NULL if they cannot be joined in this order.
+ */
+static RelOptInfo* leading_join(PlannerInfo *root, PlanfixDirectiveSet *set,
+				PlanfixDirective *d, List *initial_rels,
+				List **used)
+{
+  Oid *relids = directive_indices(set, d);
+  int nrels = list_length(root->join_rel_list);
+  RelOptInfo *joinrel = leading_find_rel(root, initial_rels, d->relation);
+  int i;
+
+  *used = list_make1(joinrel);
+  for (i = 0; i < d->nindices && joinrel != NULL; i++) {
+    RelOptInfo *rel = leading_find_rel(root, initial_rels, relids[i]);
+    if (list_member_ptr(*used, rel)) {
+      joinrel = NULL;
+      break;
+    }
+    *used = lappend(*used, rel);
+    joinrel = make_join_rel(root, joinrel, rel);
+    if (joinrel != NULL) {
+      generate_gather_paths(root, joinrel);
+      set_cheapest(joinrel);
+    }
+  }
+  if (joinrel == NULL) {
+    leading_forget_joinrels(root, nrels);
+    list_free(*used);
+    *used = NIL;
+  }
+  return joinrel;
+}
+
+/* a leading directive whose relations are all among initial_rels */
+static PlanfixDirective* leading_directive(PlannerInfo *root,
+					   List *initial_rels,
+					   PlanfixDirectiveSet **set)
+{
+  PlanfixDirectiveSet *sets[PLANFIX_NUM_SETS];
+  int i, j;
+
+  planfix_current_sets(sets);
+  for (i = 0; i < PLANFIX_NUM_SETS; i++) {
+    ListCell *c;
+    foreach (c, initial_rels) {
+      RelOptInfo *rel = (RelOptInfo *) lfirst(c);
+      RangeTblEntry *rte;
+      PlanfixDirective *d;
+
+      if (rel->reloptkind != RELOPT_BASEREL)
+	continue;
+      rte = root->simple_rte_array[rel->relid];
+      if (rte->rtekind != RTE_RELATION)
+	continue;
+      for (d = directive_set_lookup(sets[i], rte->relid); d != NULL;
+	   d = directive_next(sets[i], d)) {
+	Oid *relids = directive_indices(sets[i], d);
+	if (d->op != PLANFIX_OP_LEADING || d->nindices == 0)
+	  continue;
+	for (j = 0; j < d->nindices; j++) {
+	  if (leading_find_rel(root, initial_rels, relids[j]) == NULL)
+	    break;
+	}
+	if (j == d->nindices && directive_applies(root, rel, d)) {
+	  *set = sets[i];
+	  return d;
+	}
+      }
+    }
+  }
+  return NULL;
+}
+
+static RelOptInfo* planfixJoinSearchHook(PlannerInfo *root, int levels_needed,
+					 List *initial_rels)
+{
+  PlanfixDirectiveSet *set;
+  PlanfixDirective *d;
+  RelOptInfo *joinrel;
+  List *used, *rest;
+  ListCell *c;
+
+  d = leading_directive(root, initial_rels, &set);
+  if (d == NULL)
+    return planfix_join_search_default(root, levels_needed, initial_rels);
+  joinrel = leading_join(root, set, d, initial_rels, &used);
+  if (joinrel == NULL)
+    return planfix_join_search_default(root, levels_needed, initial_rels);
+  planfix_count(set, d, 0);
+  if (list_length(used) == list_length(initial_rels))
+    return joinrel;
+
+  rest = list_make1(joinrel);
+  foreach (c, initial_rels) {
+    if (!list_member_ptr(used, lfirst(c)))
+      rest = lappend(rest, lfirst(c));
+  }
+  return planfix_join_search_default(root, list_length(rest), rest);
+}
+
+
+
+/*
+ * Customer split a string into a tokenlist
+ */
+void SimpleStringSplit(char *s, char separator, List **tokenList)
+{
+  char *nextp = s;
+  *tokenList = NULL;
+  for(;;) {
+    int len;
+    char *curr = nextp;
+    char *endp;
+    while (*nextp && *nextp != separator)
+      nextp++;
+    endp = nextp;
+    len = endp - curr;
+    if (len >0 ) {
+      char *token = palloc(len + 1);
+      strncpy(token, curr, len);
+      token[len] = '\0';
+      *tokenList = lappend(*tokenList, token);
+    }
+    if (*nextp == '\0')
+      break;
+    else
+      ++nextp;
+  }
+}
+
+
 
-typedef enum PlanfixOp_ {
-  PLANFIX_OP_FORCEINDEX
-} PlanfixOp;
+/*
+ * SQL functions to maintain the shared directives
+ */
 
+PG_FUNCTION_INFO_V1(planfix_add_directive);
+PG_FUNCTION_INFO_V1(planfix_remove_directives);
+PG_FUNCTION_INFO_V1(planfix_clear_directives);
+PG_FUNCTION_INFO_V1(planfix_directives);
 
-typedef struct PlanfixDirectives_ {
-  PlanfixOp op;
-  Oid relation;
-  List *indices;
-} PlanfixDirective;;
+static void planfix_shared_check(void)
+{
+  if (shared == NULL)
+    ereport(ERROR,
+	    (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+	     errmsg("planfix must be loaded via shared_preload_libraries")));
+}
 
-static List *directives = NULL;
+/*
+ * planfix_add_directive(relation regclass, indexes regclass[], op text,
+ *                       queryid bigint, options text)
+ */
+Datum planfix_add_directive(PG_FUNCTION_ARGS)
+{
+  Oid relation = PG_GETARG_OID(0);
+  ArrayType *indexes = PG_GETARG_ARRAYTYPE_P(1);
+  PlanfixOp op = planfix_op_from_name(text_to_cstring(PG_GETARG_TEXT_PP(2)));
+  int64 queryId = PG_GETARG_INT64(3);
+  char *options = text_to_cstring(PG_GETARG_TEXT_PP(4));
+  PlanfixDirective parsed;
+  char *problem;
+  PlanfixSharedDirective d;
+  Datum *elems;
+  bool *nulls;
+  int i, nelems;
 
+  planfix_shared_check();
+  if (op == PLANFIX_OP_SET)
+    ereport(ERROR,
+	    (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+	     errmsg("planfix: set directives are only supported in "
+		    "planfix.set and hints")));
+  if (get_rel_relkind(relation) != RELKIND_RELATION)
+    ereport(ERROR,
+	    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+	     errmsg("planfix: %s is not a table", get_rel_name(relation))));
 
-/* current values for configuration guc-variables */
-static char *varForcedIndex = "";
+  deconstruct_array(indexes, REGCLASSOID, sizeof(Oid), true, 'i',
+		    &elems, &nulls, &nelems);
+  if (nelems > PLANFIX_MAX_INDICES)
+    ereport(ERROR,
+	    (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+	     errmsg("planfix: at most %d indices per directive",
+		    PLANFIX_MAX_INDICES)));
 
-/* planfix utils */
+  parsed.op = op;
+  memset(&parsed.opts, 0, sizeof(PlanfixOptions));
+  if (!directive_parse_options(options, &parsed, &problem))
+    ereport(ERROR,
+	    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+	     errmsg("%s", problem)));
+  if (queryId != 0)
+    parsed.opts.queryId = (uint64) queryId;
 
-static void directive_free(PlanfixDirective* d) 
-{
-  list_free(d->indices);
-  free(d);
+  memset(&d, 0, sizeof(d));
+  d.database = MyDatabaseId;
+  d.op = parsed.op;
+  d.relation = relation;
+  d.opts = parsed.opts;
+  for (i = 0; i < nelems; i++) {
+    Oid index;
+    if (nulls[i])
+      continue;
+    index = DatumGetObjectId(elems[i]);
+    if (planfix_op_names_relations(d.op)) {
+      if (get_rel_relkind(index) != RELKIND_RELATION)
+	ereport(ERROR,
+		(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+		 errmsg("planfix: %s is not a table", get_rel_name(index))));
+    } else if (get_rel_relkind(index) != RELKIND_INDEX ||
+	       IndexGetRelation(index, false) != relation)
+      ereport(ERROR,
+	      (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+	       errmsg("planfix: %s is not an index of %s",
+		      get_rel_name(index), get_rel_name(relation))));
+    d.indices[d.nindices++] = index;
+  }
+  d.nindices = directive_oids_normalize(d.op, d.indices, d.nindices);
+  if (planfix_op_needs_join(d.op) && d.nindices == 0)
+    ereport(ERROR,
+	    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+	     errmsg("planfix: a join needs at least two relations")));
+
+  LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+  if (shared->ndirectives >= PLANFIX_MAX_DIRECTIVES) {
+    LWLockRelease(shared->lock);
+    ereport(ERROR,
+	    (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+	     errmsg("planfix: at most %d shared directives",
+		    PLANFIX_MAX_DIRECTIVES)));
+  }
+  shared->directives[shared->ndirectives++] = d;
+  pg_atomic_fetch_add_u32(&shared->generation, 1);
+  LWLockRelease(shared->lock);
+
+  PG_RETURN_VOID();
 }
 
-#ifdef PLANFIX_DEBUG
-static void directive_print(PlanfixDirective* d) 
+/* remove the directives of relation, or all of this database */
+static int planfix_shared_remove(Oid relation)
 {
-  ListCell *c;
-  printf(">> PlanfixDirective op=%d, relation=%u\n", d->op, d->relation);
-  foreach (c, d->indices) {
-    Oid index = lfirst_oid(c);
-    printf(">>   index=%d\n", index);
+  int i, n = 0;
+
+  LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+  for (i = 0; i < shared->ndirectives; i++) {
+    PlanfixSharedDirective *d = &shared->directives[i];
+    if (d->database == MyDatabaseId &&
+	(relation == InvalidOid || d->relation == relation))
+      continue;
+    if (n != i)
+      shared->directives[n] = *d;
+    n++;
   }
+  i = shared->ndirectives - n;
+  shared->ndirectives = n;
+  if (i > 0)
+    pg_atomic_fetch_add_u32(&shared->generation, 1);
+  LWLockRelease(shared->lock);
+  return i;
 }
-#endif /* PLANFIX_DEBUG */
-
 
+/* planfix_remove_directives(relation regclass) */
+Datum planfix_remove_directives(PG_FUNCTION_ARGS)
+{
+  Oid relation = PG_GETARG_OID(0);
+  planfix_shared_check();
+  PG_RETURN_INT32(planfix_shared_remove(relation));
+}
 
-/* dealing with set,check,show of forced index */
-static bool varForcedIndexCheck(char **newval, void **extra, GucSource source)
+/* planfix_clear_directives() */
+Datum planfix_clear_directives(PG_FUNCTION_ARGS)
 {
-  return true;
+  planfix_shared_check();
+  PG_RETURN_INT32(planfix_shared_remove(InvalidOid));
 }
 
+/*
+ * Statement trigger on planfix_directive, invalidate the relcache entry
+ * of the table so all backends load the directives again.
+ */
+PG_FUNCTION_INFO_V1(planfix_directive_changed);
 
-static void varForcedIndexAssign(const char *newval, void *extra)
+Datum planfix_directive_changed(PG_FUNCTION_ARGS)
+{
+  TriggerData *trigdata = (TriggerData *) fcinfo->context;
+
+  if (!CALLED_AS_TRIGGER(fcinfo))
+    elog(ERROR, "planfix_directive_changed: not called by trigger manager");
+  CacheInvalidateRelcache(trigdata->tg_relation);
+  return PointerGetDatum(NULL);
+}
+
+/* set up a materialized set returning function, pg_stat_statements style */
+static Tuplestorestate* planfix_srf_begin(FunctionCallInfo fcinfo,
+					  TupleDesc *tupdesc)
 {
+  ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
   MemoryContext oldmc;
-  char *rawname = pstrdup(newval);
-  List *sections = NULL;
-  List *section = NULL;
-  List *tmpdirectives = NULL;
-  ListCell *c;
+  Tuplestorestate *tupstore;
 
-  oldmc = MemoryContextSwitchTo(mc);
+  if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+    ereport(ERROR,
+	    (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+	     errmsg("set-valued function called in context that cannot accept a set")));
+  if (!(rsinfo->allowedModes & SFRM_Materialize))
+    ereport(ERROR,
+	    (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+	     errmsg("materialize mode required, but it is not allowed in this context")));
+  if (get_call_result_type(fcinfo, NULL, tupdesc) != TYPEFUNC_COMPOSITE)
+    elog(ERROR, "return type must be a row type");
 
-  {
-    List *fordelete = NULL;
-    foreach(c, directives) {
-      PlanfixDirective *d = (PlanfixDirective*) lfirst(c);
-      if (d->op == PLANFIX_OP_FORCEINDEX) 
-	fordelete = lappend(fordelete, d);
-    }
-    if (fordelete != NULL) {
-      foreach(c, fordelete) {
-	PlanfixDirective *d = (PlanfixDirective*) lfirst(c);
-	directive_free(d);
-	directives = list_delete_ptr(directives, d);
-      }
-    }
-  }
-  
-  SimpleStringSplit(rawname, ';', &sections);
-  foreach(c, sections) {
-    ListCell *c2;
-    char *s = (char *) lfirst(c);
-    PlanfixDirective *d = palloc(sizeof(PlanfixDirective));
-    section = NULL;
-    SimpleStringSplit(s, ',', &section);
-    d->op = PLANFIX_OP_FORCEINDEX;
-    d->relation = InvalidOid;
-    d->indices = NULL;
+  oldmc = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+  *tupdesc = CreateTupleDescCopy(*tupdesc);
+  tupstore = tuplestore_begin_heap(true, false, work_mem);
+  rsinfo->returnMode = SFRM_Materialize;
+  rsinfo->setResult = tupstore;
+  rsinfo->setDesc = *tupdesc;
+  MemoryContextSwitchTo(oldmc);
+  return tupstore;
+}
 
-    foreach (c2, section) {
-      Oid oid;
-      RangeVar *nameRange;
-      List *qualifiedNameList;
-      char *name = (char *) lfirst(c2);
-      qualifiedNameList = stringToQualifiedNameList(name);
-      nameRange = makeRangeVarFromNameList(qualifiedNameList);
-      oid = RangeVarGetRelid(nameRange, NoLock, true);
-
-      if (oid == InvalidOid) {
-	elog(ERROR, "planfix: oid invalid for name %s", name);
-	goto error;
-      }  else if (get_rel_relkind(oid) == RELKIND_RELATION) {
-	if (d->relation != InvalidOid) {
-	  elog(ERROR, "planfix: only one relation must be defined %s", name);
-	  goto error;
-	}
-	d->relation = oid;
-      } else if (get_rel_relkind(oid) == RELKIND_INDEX) {
-	if (d->relation == InvalidOid) {
-	  elog(ERROR, "planfix: one relation must be defined first: %s", name);
-	  goto error;
-	}
-	d->indices = lappend_oid(d->indices, oid);
-      } else {
-	  elog(ERROR, "planfix: unhandled relkind for %s", name);
-	  goto error;
-      }
-    }
-    tmpdirectives = lappend(tmpdirectives, d);
-  }
+/*
+ * planfix_directives() returns (relation regclass, indexes regclass[],
+ *                               op text, queryid bigint, options text)
+ */
+Datum planfix_directives(PG_FUNCTION_ARGS)
+{
+  TupleDesc tupdesc;
+  Tuplestorestate *tupstore;
+  int i;
 
-  foreach(c,tmpdirectives) {
-    directives = lappend(directives, lfirst(c));
+  planfix_shared_check();
+  tupstore = planfix_srf_begin(fcinfo, &tupdesc);
+
+  LWLockAcquire(shared->lock, LW_SHARED);
+  for (i = 0; i < shared->ndirectives; i++) {
+    PlanfixSharedDirective *d = &shared->directives[i];
+    Datum values[5];
+    bool nulls[5] = {false, false, false, false, false};
+    Datum indices[PLANFIX_MAX_INDICES];
+    int j;
+
+    if (d->database != MyDatabaseId)
+      continue;
+    for (j = 0; j < d->nindices; j++)
+      indices[j] = ObjectIdGetDatum(d->indices[j]);
+    values[0] = ObjectIdGetDatum(d->relation);
+    values[1] = PointerGetDatum(construct_array(indices, d->nindices,
+						REGCLASSOID, sizeof(Oid),
+						true, 'i'));
+    values[2] = CStringGetTextDatum(planfixOpNames[d->op]);
+    values[3] = Int64GetDatum((int64) d->opts.queryId);
+    nulls[3] = (d->opts.queryId == 0);
+    values[4] = CStringGetTextDatum(directive_options_text(&d->opts));
+    tuplestore_putvalues(tupstore, tupdesc, values, nulls);
   }
+  LWLockRelease(shared->lock);
+
+  tuplestore_donestoring(tupstore);
+  return (Datum) 0;
+}
 
-  goto cleanup;
 
- error:
-  foreach (c,tmpdirectives) {
-    directive_free((PlanfixDirective*) lfirst(c));
+
+/* the counters of the directives of this database */
+PG_FUNCTION_INFO_V1(planfix_stats);
+
+Datum planfix_stats(PG_FUNCTION_ARGS)
+{
+  TupleDesc tupdesc;
+  Tuplestorestate *tupstore;
+  int i, j;
+
+  planfix_shared_check();
+  tupstore = planfix_srf_begin(fcinfo, &tupdesc);
+  for (i = 0; i < PLANFIX_MAX_COUNTERS; i++) {
+    PlanfixCounter *counter = &shared->counters[i];
+    PlanfixSharedDirective *d = &counter->key;
+    Datum values[9];
+    bool nulls[9] = {false, false, false, false, false, false, false, false,
+		     false};
+    Datum *elems;
+    uint64 lastHit;
+
+    if (pg_atomic_read_u32(&counter->used) == 0)
+      continue;
+    pg_read_barrier();
+    if (d->database != MyDatabaseId)
+      continue;
+    elems = palloc(sizeof(Datum) * Max(d->nindices, 1));
+    for (j = 0; j < d->nindices; j++)
+      elems[j] = ObjectIdGetDatum(d->indices[j]);
+    values[0] = ObjectIdGetDatum(d->relation);
+    values[1] = PointerGetDatum(construct_array(elems, d->nindices,
+						REGCLASSOID, sizeof(Oid),
+						true, 'i'));
+    values[2] = CStringGetTextDatum(planfixOpNames[d->op]);
+    values[3] = Int64GetDatum((int64) d->opts.queryId);
+    nulls[3] = (d->opts.queryId == 0);
+    values[4] = CStringGetTextDatum(directive_options_text(&d->opts));
+    values[5] = Int64GetDatum((int64) pg_atomic_read_u64(&counter->matched));
+    values[6] = Int64GetDatum((int64) pg_atomic_read_u64(&counter->pruned));
+    values[7] = Int64GetDatum((int64) pg_atomic_read_u64(&counter->micros));
+    lastHit = pg_atomic_read_u64(&counter->lastHit);
+    values[8] = TimestampTzGetDatum((TimestampTz) lastHit);
+    nulls[8] = (lastHit == 0);
+    tuplestore_putvalues(tupstore, tupdesc, values, nulls);
   }
- cleanup:
-  list_free(tmpdirectives);
-  list_free(sections);
-  list_free(section);
-  pfree(rawname);
-#ifdef PLANFIX_DEBUG
-  foreach(c,directives) {
-    PlanfixDirective *d = (PlanfixDirective*) lfirst(c);
-    directive_print(d);
+  tuplestore_donestoring(tupstore);
+  return (Datum) 0;
+}
+
+/* zero the counters of all directives */
+PG_FUNCTION_INFO_V1(planfix_stats_reset);
+
+Datum planfix_stats_reset(PG_FUNCTION_ARGS)
+{
+  int i;
+
+  planfix_shared_check();
+  for (i = 0; i < PLANFIX_MAX_COUNTERS; i++) {
+    PlanfixCounter *counter = &shared->counters[i];
+    pg_atomic_write_u64(&counter->matched, 0);
+    pg_atomic_write_u64(&counter->pruned, 0);
+    pg_atomic_write_u64(&counter->micros, 0);
+    pg_atomic_write_u64(&counter->lastHit, 0);
   }
-#endif /* PLANFIX_DEBUG */
-  MemoryContextSwitchTo(oldmc);
+  PG_RETURN_VOID();
 }
 
+/* the nonempty buckets of the timing histograms */
+PG_FUNCTION_INFO_V1(planfix_timing);
 
-static const char* varForcedIndexShow()
+Datum planfix_timing(PG_FUNCTION_ARGS)
 {
-  char *v;
-  v = palloc(strlen(varForcedIndex) + 1);
-  strcpy(v, varForcedIndex);
-  return v;
+  TupleDesc tupdesc;
+  Tuplestorestate *tupstore;
+  int i, j;
+
+  planfix_shared_check();
+  tupstore = planfix_srf_begin(fcinfo, &tupdesc);
+  for (i = 0; i < PLANFIX_NUM_TIMINGS; i++) {
+    for (j = 0; j < PLANFIX_TIMING_BUCKETS; j++) {
+      uint64 n = pg_atomic_read_u64(&shared->timings[i].buckets[j]);
+      Datum values[4];
+      bool nulls[4] = {false, false, false, false};
+
+      if (n == 0)
+	continue;
+      values[0] = CStringGetTextDatum(planfixTimingNames[i]);
+      values[1] = Int64GetDatum((int64) timing_bucket_lower(j));
+      values[2] = Int64GetDatum((int64) timing_bucket_lower(j + 1));
+      values[3] = Int64GetDatum((int64) n);
+      tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+  }
+  tuplestore_donestoring(tupstore);
+  return (Datum) 0;
 }
 
+/* statements and total time by kind of timing */
+PG_FUNCTION_INFO_V1(planfix_timing_totals);
+
+Datum planfix_timing_totals(PG_FUNCTION_ARGS)
+{
+  TupleDesc tupdesc;
+  Tuplestorestate *tupstore;
+  int i;
 
+  planfix_shared_check();
+  tupstore = planfix_srf_begin(fcinfo, &tupdesc);
+  for (i = 0; i < PLANFIX_NUM_TIMINGS; i++) {
+    PlanfixHistogram *h = &shared->timings[i];
+    Datum values[3];
+    bool nulls[3] = {false, false, false};
 
-/* 
- * Planner hook, loop through the list of directives.
- * The list if expected to be short and we check for the main table
- * relation first, so unless that one is matched we will not incur
- * any overhead.
- */
-static void planfixHook(PlannerInfo *root, Oid relationObjectId, bool inhparent,
-                        RelOptInfo *rel) 
+    values[0] = CStringGetTextDatum(planfixTimingNames[i]);
+    values[1] = Int64GetDatum((int64) pg_atomic_read_u64(&h->statements));
+    values[2] = Int64GetDatum((int64) pg_atomic_read_u64(&h->micros));
+    tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+  }
+  tuplestore_donestoring(tupstore);
+  return (Datum) 0;
+}
+
+PG_FUNCTION_INFO_V1(planfix_timing_reset);
+
+Datum planfix_timing_reset(PG_FUNCTION_ARGS)
 {
-  ListCell *c;
-  foreach (c, directives) {
-    PlanfixDirective *d = (PlanfixDirective*) lfirst(c);
-    if (d->op == PLANFIX_OP_FORCEINDEX && d->relation == relationObjectId && d->indices != NULL) {
-      Relation relation;
-      relation = heap_open(relationObjectId, NoLock);
-#ifdef PLANFIX_DEBUG
-      printf(">> checking rel %s\n", get_rel_name(relationObjectId));
-#endif
-      if (relation->rd_rel->relkind == RELKIND_RELATION) {
-	ListCell *c2;
-	List *fordelete = NULL;
-	foreach (c2, rel->indexlist) {
-	  IndexOptInfo *info = (IndexOptInfo *)lfirst(c2);
-	  bool allowed = list_member_oid(d->indices, info->indexoid);
-#ifdef PLANFIX_DEBUG
-	  printf(">>  allowed=%d for indexoid=%d\n", allowed, info->indexoid);
-#endif
-	  if (!allowed) {
-	    fordelete = lappend(fordelete, info);
-	  }
-	}
-	foreach (c2, fordelete) {
-	  IndexOptInfo *info = (IndexOptInfo *)lfirst(c2);
-	  rel->indexlist = list_delete_ptr(rel->indexlist, info);
-	}
-      }
-      heap_close(relation, NoLock);
-    }
+  int i, j;
+
+  planfix_shared_check();
+  for (i = 0; i < PLANFIX_NUM_TIMINGS; i++) {
+    PlanfixHistogram *h = &shared->timings[i];
+    pg_atomic_write_u64(&h->statements, 0);
+    pg_atomic_write_u64(&h->micros, 0);
+    for (j = 0; j < PLANFIX_TIMING_BUCKETS; j++)
+      pg_atomic_write_u64(&h->buckets[j], 0);
   }
-  if (oldHook)
-    oldHook(root, relationObjectId, inhparent, rel);
+  PG_RETURN_VOID();
 }
 
+/*
+ * The pg_statistic rows of a relation as raw tuples, for
+ * planfix_freeze_stats.
+ */
+PG_FUNCTION_INFO_V1(planfix_statistic);
+
+Datum planfix_statistic(PG_FUNCTION_ARGS)
+{
+  Oid relation = PG_GETARG_OID(0);
+  TupleDesc tupdesc;
+  Tuplestorestate *tupstore;
+  CatCList *list;
+  int i;
+
+  tupstore = planfix_srf_begin(fcinfo, &tupdesc);
+  list = SearchSysCacheList1(STATRELATTINH, ObjectIdGetDatum(relation));
+  for (i = 0; i < list->n_members; i++) {
+    HeapTuple tuple = &list->members[i]->tuple;
+    Form_pg_statistic stats = (Form_pg_statistic) GETSTRUCT(tuple);
+    bytea *raw = palloc(VARHDRSZ + tuple->t_len);
+    Datum values[3];
+    bool nulls[3] = {false, false, false};
 
+    SET_VARSIZE(raw, VARHDRSZ + tuple->t_len);
+    memcpy(VARDATA(raw), tuple->t_data, tuple->t_len);
+    values[0] = Int16GetDatum(stats->staattnum);
+    values[1] = BoolGetDatum(stats->stainherit);
+    values[2] = PointerGetDatum(raw);
+    tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+  }
+  ReleaseSysCacheList(list);
+  tuplestore_donestoring(tupstore);
+  return (Datum) 0;
+}
 
 /*
- * Customer split a string into a tokenlist
+ * Statistics files. planfix_export_stats writes the sizes and the
+ * pg_statistic tuples of relations and their indices to a server side
+ * file, planfix_read_stats returns them as rows again, from which
+ * planfix_import_stats fills the frozen tables. Relations are named
+ * qualified and columns by name, so the file can be read in a database
+ * with other oids and attribute numbers.
+ * The file is a header followed by records, in the byte order of the
+ * server, and is only read by a server of the same major version and
+ * architecture, as the tuples are in the on-disk format.
+ *
+ *   header     PLANFIX_STATS_MAGIC, uint32 PG_VERSION_NUM / 100
+ *   class      'C', name, int32 relpages, float4 reltuples,
+ *              int32 relallvisible
+ *   statistic  'S', name, column name, uint32 type oid, uint32 length,
+ *              tuple
+ *   end        'E'
+ *
+ * where a name is a uint32 length followed by the qualified name, and
+ * the column name and type are those of staattnum.
  */
-void SimpleStringSplit(char *s, char separator, List **tokenList)
+#define PLANFIX_STATS_MAGIC "PLANFIX STATS 2\n"
+
+static void stats_write(FILE *file, const char *filename, const void *data,
+			Size len)
 {
-  char *nextp = s;
-  *tokenList = NULL;
-  for(;;) {
-    int len;
-    char *curr = nextp;
-    char *endp;
-    while (*nextp && *nextp != separator)
-      nextp++;
-    endp = nextp;
-    len = endp - curr;
-    if (len >0 ) {
-      char *token = palloc(len + 1);
-      strncpy(token, curr, len);
-      token[len] = '\0';
-      *tokenList = lappend(*tokenList, token);
-    }
-    if (*nextp == '\0')
-      break;
-    else
-      ++nextp;
+  if (fwrite(data, 1, len, file) != len)
+    ereport(ERROR,
+	    (errcode_for_file_access(),
+	     errmsg("planfix: could not write file \"%s\": %m", filename)));
+}
+
+static void stats_read(FILE *file, const char *filename, void *data, Size len)
+{
+  if (fread(data, 1, len, file) != len)
+    ereport(ERROR,
+	    (errcode(ERRCODE_DATA_CORRUPTED),
+	     errmsg("planfix: unexpected end of file \"%s\"", filename)));
+}
+
+/* a length as written by stats_write_bytes, at most max */
+static uint32 stats_read_length(FILE *file, const char *filename, uint32 max)
+{
+  uint32 len;
+
+  stats_read(file, filename, &len, sizeof(len));
+  if (len > max)
+    ereport(ERROR,
+	    (errcode(ERRCODE_DATA_CORRUPTED),
+	     errmsg("planfix: corrupted file \"%s\"", filename)));
+  return len;
+}
+
+static void stats_write_bytes(FILE *file, const char *filename,
+			      const void *data, uint32 len)
+{
+  stats_write(file, filename, &len, sizeof(len));
+  stats_write(file, filename, data, len);
+}
+
+/* write the class record and the statistics of one relation */
+static int stats_export_relation(FILE *file, const char *filename, Oid oid)
+{
+  HeapTuple tuple;
+  Form_pg_class form;
+  CatCList *list;
+  char *name;
+  int32 pages, allvisible;
+  float4 tuples;
+  int i, n = 1;
+
+  tuple = SearchSysCache1(RELOID, ObjectIdGetDatum(oid));
+  if (!HeapTupleIsValid(tuple))
+    elog(ERROR, "planfix: cache lookup failed for relation %u", oid);
+  form = (Form_pg_class) GETSTRUCT(tuple);
+  pages = form->relpages;
+  tuples = form->reltuples;
+  allvisible = form->relallvisible;
+  ReleaseSysCache(tuple);
+
+  name = quote_qualified_identifier(get_namespace_name(get_rel_namespace(oid)),
+				    get_rel_name(oid));
+  stats_write(file, filename, "C", 1);
+  stats_write_bytes(file, filename, name, strlen(name));
+  stats_write(file, filename, &pages, sizeof(pages));
+  stats_write(file, filename, &tuples, sizeof(tuples));
+  stats_write(file, filename, &allvisible, sizeof(allvisible));
+
+  list = SearchSysCacheList1(STATRELATTINH, ObjectIdGetDatum(oid));
+  for (i = 0; i < list->n_members; i++) {
+    Form_pg_statistic stats;
+    char *attname;
+    uint32 atttype;
+
+    tuple = &list->members[i]->tuple;
+    stats = (Form_pg_statistic) GETSTRUCT(tuple);
+    attname = get_attname(oid, stats->staattnum);
+    if (attname == NULL)
+      continue;
+    atttype = get_atttype(oid, stats->staattnum);
+    stats_write(file, filename, "S", 1);
+    stats_write_bytes(file, filename, name, strlen(name));
+    stats_write_bytes(file, filename, attname, strlen(attname));
+    stats_write(file, filename, &atttype, sizeof(atttype));
+    stats_write_bytes(file, filename, tuple->t_data, tuple->t_len);
+    pfree(attname);
+    n++;
+  }
+  ReleaseSysCacheList(list);
+  pfree(name);
+  return n;
+}
+
+PG_FUNCTION_INFO_V1(planfix_export_stats);
+
+Datum planfix_export_stats(PG_FUNCTION_ARGS)
+{
+  char *filename = text_to_cstring(PG_GETARG_TEXT_PP(0));
+  ArrayType *relations = PG_GETARG_ARRAYTYPE_P(1);
+  uint32 version = PG_VERSION_NUM / 100;
+  Datum *elems;
+  bool *nulls;
+  int i, nelems, n = 0;
+  FILE *file;
+
+  if (!superuser())
+    ereport(ERROR,
+	    (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+	     errmsg("planfix: must be superuser to write files")));
+
+  deconstruct_array(relations, REGCLASSOID, sizeof(Oid), true, 'i',
+		    &elems, &nulls, &nelems);
+  file = AllocateFile(filename, PG_BINARY_W);
+  if (file == NULL)
+    ereport(ERROR,
+	    (errcode_for_file_access(),
+	     errmsg("planfix: could not open file \"%s\": %m", filename)));
+  stats_write(file, filename, PLANFIX_STATS_MAGIC,
+	      strlen(PLANFIX_STATS_MAGIC));
+  stats_write(file, filename, &version, sizeof(version));
+  for (i = 0; i < nelems; i++) {
+    Relation relation;
+    List *indices;
+    ListCell *c;
+
+    if (nulls[i])
+      continue;
+    relation = relation_open(DatumGetObjectId(elems[i]), AccessShareLock);
+    indices = RelationGetIndexList(relation);
+    relation_close(relation, AccessShareLock);
+
+    n += stats_export_relation(file, filename, DatumGetObjectId(elems[i]));
+    foreach (c, indices)
+      n += stats_export_relation(file, filename, lfirst_oid(c));
+    list_free(indices);
   }
+  stats_write(file, filename, "E", 1);
+  if (FreeFile(file) != 0)
+    ereport(ERROR,
+	    (errcode_for_file_access(),
+	     errmsg("planfix: could not write file \"%s\": %m", filename)));
+  PG_RETURN_INT32(n);
 }
 
+PG_FUNCTION_INFO_V1(planfix_read_stats);
+
+Datum planfix_read_stats(PG_FUNCTION_ARGS)
+{
+  char *filename = text_to_cstring(PG_GETARG_TEXT_PP(0));
+  char magic[sizeof(PLANFIX_STATS_MAGIC) - 1];
+  uint32 version;
+  TupleDesc tupdesc;
+  Tuplestorestate *tupstore;
+  FILE *file;
+
+  if (!superuser())
+    ereport(ERROR,
+	    (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+	     errmsg("planfix: must be superuser to read files")));
+
+  tupstore = planfix_srf_begin(fcinfo, &tupdesc);
+  file = AllocateFile(filename, PG_BINARY_R);
+  if (file == NULL)
+    ereport(ERROR,
+	    (errcode_for_file_access(),
+	     errmsg("planfix: could not open file \"%s\": %m", filename)));
+  stats_read(file, filename, magic, sizeof(magic));
+  stats_read(file, filename, &version, sizeof(version));
+  if (memcmp(magic, PLANFIX_STATS_MAGIC, sizeof(magic)) != 0)
+    ereport(ERROR,
+	    (errcode(ERRCODE_DATA_CORRUPTED),
+	     errmsg("planfix: \"%s\" is not a statistics file", filename)));
+  if (version != PG_VERSION_NUM / 100)
+    ereport(ERROR,
+	    (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+	     errmsg("planfix: \"%s\" was written by another major version",
+		    filename)));
+
+  for (;;) {
+    Datum values[9];
+    bool nulls[9] = {true, true, true, true, true, true, true, true, true};
+    char kind;
+    char *name;
+    uint32 len;
 
+    stats_read(file, filename, &kind, 1);
+    if (kind == 'E')
+      break;
+    if (kind != 'C' && kind != 'S')
+      ereport(ERROR,
+	      (errcode(ERRCODE_DATA_CORRUPTED),
+	       errmsg("planfix: corrupted file \"%s\"", filename)));
+    len = stats_read_length(file, filename, 4 * NAMEDATALEN);
+    name = palloc(len + 1);
+    stats_read(file, filename, name, len);
+    name[len] = '\0';
+    values[0] = CStringGetTextDatum(name);
+    nulls[0] = false;
+
+    if (kind == 'C') {
+      int32 pages, allvisible;
+      float4 tuples;
+      stats_read(file, filename, &pages, sizeof(pages));
+      stats_read(file, filename, &tuples, sizeof(tuples));
+      stats_read(file, filename, &allvisible, sizeof(allvisible));
+      values[1] = Int32GetDatum(pages);
+      values[2] = Float4GetDatum(tuples);
+      values[3] = Int32GetDatum(allvisible);
+      nulls[1] = nulls[2] = nulls[3] = false;
+    } else {
+      HeapTupleHeader header;
+      Form_pg_statistic stats;
+      bytea *raw;
+      char *attname;
+      uint32 atttype;
+      len = stats_read_length(file, filename, NAMEDATALEN);
+      attname = palloc(len + 1);
+      stats_read(file, filename, attname, len);
+      attname[len] = '\0';
+      stats_read(file, filename, &atttype, sizeof(atttype));
+      len = stats_read_length(file, filename, MaxAllocSize - VARHDRSZ);
+      raw = palloc(VARHDRSZ + len);
+      SET_VARSIZE(raw, VARHDRSZ + len);
+      stats_read(file, filename, VARDATA(raw), len);
+      header = (HeapTupleHeader) VARDATA(raw);
+      if (len < SizeofHeapTupleHeader ||
+	  header->t_hoff + offsetof(FormData_pg_statistic, stainherit) +
+	  sizeof(bool) > len)
+	ereport(ERROR,
+		(errcode(ERRCODE_DATA_CORRUPTED),
+		 errmsg("planfix: corrupted file \"%s\"", filename)));
+      stats = (Form_pg_statistic) ((char *) header + header->t_hoff);
+      values[4] = Int16GetDatum(stats->staattnum);
+      values[5] = CStringGetTextDatum(attname);
+      values[6] = ObjectIdGetDatum(atttype);
+      values[7] = BoolGetDatum(stats->stainherit);
+      values[8] = PointerGetDatum(raw);
+      nulls[4] = nulls[5] = nulls[6] = nulls[7] = nulls[8] = false;
+    }
+    tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    pfree(name);
+  }
+  FreeFile(file);
+  tuplestore_donestoring(tupstore);
+  return (Datum) 0;
+}
 
 /* 
  * Initialize this extension...
@@ -352,10 +4634,254 @@ void _PG_init(void)
       varForcedIndexAssign,
       varForcedIndexShow);
 
+  DefineCustomStringVariable(
+      "planfix.disabledindex",
+      "Indices the planner must not use.",
+      "Same syntax as planfix.forcedindex, the named indices of a "
+      "relation are removed, all others are kept.",
+      &varDisabledIndex,
+      "",
+      PGC_USERSET,
+      0,
+      varDisabledIndexCheck,
+      varDisabledIndexAssign,
+      NULL);
+
+  DefineCustomStringVariable(
+      "planfix.preferredindex",
+      "Indices the planner should prefer.",
+      "Same syntax as planfix.forcedindex, paths of a relation that "
+      "do not use one of the named indices are penalized by "
+      "planfix.prefer_penalty.",
+      &varPreferredIndex,
+      "",
+      PGC_USERSET,
+      0,
+      varPreferredIndexCheck,
+      varPreferredIndexAssign,
+      NULL);
+
+  DefineCustomStringVariable(
+      "planfix.nestloop",
+      "Joins the planner must implement by a nested loop.",
+      "Sections of the relations of a join, separated by ;.",
+      &varNestLoop,
+      "",
+      PGC_USERSET,
+      0,
+      varNestLoopCheck,
+      varNestLoopAssign,
+      NULL);
+
+  DefineCustomStringVariable(
+      "planfix.hashjoin",
+      "Joins the planner must implement by a hash join.",
+      "Sections of the relations of a join, separated by ;.",
+      &varHashJoin,
+      "",
+      PGC_USERSET,
+      0,
+      varHashJoinCheck,
+      varHashJoinAssign,
+      NULL);
+
+  DefineCustomStringVariable(
+      "planfix.mergejoin",
+      "Joins the planner must implement by a merge join.",
+      "Sections of the relations of a join, separated by ;.",
+      &varMergeJoin,
+      "",
+      PGC_USERSET,
+      0,
+      varMergeJoinCheck,
+      varMergeJoinAssign,
+      NULL);
+
+  DefineCustomStringVariable(
+      "planfix.leading",
+      "Relations the planner must join first, in the order given.",
+      "Sections of the relations to join, separated by ;.",
+      &varLeading,
+      "",
+      PGC_USERSET,
+      0,
+      varLeadingCheck,
+      varLeadingAssign,
+      NULL);
+
+  DefineCustomStringVariable(
+      "planfix.rows",
+      "Row estimates of relations and joins.",
+      "Sections of the relations of a relation or join, with an option "
+      "rows=N, rows*F, rows>=N or rows<=N, separated by ;.",
+      &varRows,
+      "",
+      PGC_USERSET,
+      0,
+      varRowsCheck,
+      varRowsAssign,
+      NULL);
+
+  DefineCustomStringVariable(
+      "planfix.seqscan",
+      "Relations the planner must scan sequentially.",
+      NULL,
+      &varSeqScan,
+      "",
+      PGC_USERSET,
+      0,
+      varSeqScanCheck,
+      varSeqScanAssign,
+      NULL);
+
+  DefineCustomStringVariable(
+      "planfix.indexscan",
+      "Relations the planner must scan by an index scan.",
+      "Same syntax as planfix.forcedindex, without indices any index "
+      "may be used.",
+      &varIndexScan,
+      "",
+      PGC_USERSET,
+      0,
+      varIndexScanCheck,
+      varIndexScanAssign,
+      NULL);
+
+  DefineCustomStringVariable(
+      "planfix.indexonlyscan",
+      "Relations the planner must scan by an index only scan.",
+      "Same syntax as planfix.forcedindex, without indices any index "
+      "may be used.",
+      &varIndexOnlyScan,
+      "",
+      PGC_USERSET,
+      0,
+      varIndexOnlyScanCheck,
+      varIndexOnlyScanAssign,
+      NULL);
+
+  DefineCustomStringVariable(
+      "planfix.bitmapscan",
+      "Relations the planner must scan by a bitmap scan.",
+      "Same syntax as planfix.forcedindex, without indices any index "
+      "may be used.",
+      &varBitmapScan,
+      "",
+      PGC_USERSET,
+      0,
+      varBitmapScanCheck,
+      varBitmapScanAssign,
+      NULL);
+
+  DefineCustomStringVariable(
+      "planfix.parallelworkers",
+      "Parallel workers of relations, overriding their reloption.",
+      "Sections are relation,workers=N.",
+      &varParallelWorkers,
+      "",
+      PGC_USERSET,
+      0,
+      varParallelWorkersCheck,
+      varParallelWorkersAssign,
+      NULL);
+
+  DefineCustomStringVariable(
+      "planfix.set",
+      "Parameters to set while planning queries on relations.",
+      "Sections are relations followed by name=value settings.",
+      &varSet,
+      "",
+      PGC_USERSET,
+      0,
+      varSetCheck,
+      varSetAssign,
+      NULL);
+
+  DefineCustomRealVariable(
+      "planfix.prefer_penalty",
+      "Cost factor for paths not using a preferred index.",
+      NULL,
+      &varPreferPenalty,
+      100.0,
+      1.0,
+      1.0e10,
+      PGC_USERSET,
+      0,
+      NULL,
+      NULL,
+      NULL);
+
+  DefineCustomBoolVariable(
+      "planfix.track_timing",
+      "Collects histograms of the planning time and the time in planfix.",
+      "Needs planfix in shared_preload_libraries.",
+      &varTrackTiming,
+      false,
+      PGC_SUSET,
+      0,
+      NULL,
+      NULL,
+      NULL);
+
+  DefineCustomBoolVariable(
+      "planfix.index_diet",
+      "Ignores indices whose leading column the query does not use.",
+      NULL,
+      &varIndexDiet,
+      false,
+      PGC_USERSET,
+      0,
+      NULL,
+      NULL,
+      NULL);
+
+  CacheRegisterRelcacheCallback(planfixRelcacheCallback, (Datum) 0);
+  CacheRegisterSyscacheCallback(RELNAMENSP, planfixSyscacheCallback, (Datum) 0);
+  CacheRegisterSyscacheCallback(NAMESPACEOID, planfixSyscacheCallback, (Datum) 0);
+
+  if (process_shared_preload_libraries_in_progress) {
+    RequestAddinShmemSpace(sizeof(PlanfixShared));
+    RequestNamedLWLockTranche("planfix", 1);
+    oldShmemStartupHook = shmem_startup_hook;
+    shmem_startup_hook = planfixShmemStartup;
+  }
+
   if (get_relation_info_hook != planfixHook) {
     oldHook = get_relation_info_hook;
     get_relation_info_hook = planfixHook;
   }
+  if (ExplainOneQuery_hook != planfixExplainOneQuery) {
+    oldExplainOneQueryHook = ExplainOneQuery_hook;
+    ExplainOneQuery_hook = planfixExplainOneQuery;
+  }
+  if (planner_hook != planfixPlanner) {
+    oldPlannerHook = planner_hook;
+    planner_hook = planfixPlanner;
+  }
+  if (ExecutorRun_hook != planfixExecutorRun) {
+    oldExecutorRunHook = ExecutorRun_hook;
+    ExecutorRun_hook = planfixExecutorRun;
+  }
+  if (get_relation_stats_hook != planfixRelationStatsHook) {
+    oldRelationStatsHook = get_relation_stats_hook;
+    get_relation_stats_hook = planfixRelationStatsHook;
+  }
+  if (get_index_stats_hook != planfixIndexStatsHook) {
+    oldIndexStatsHook = get_index_stats_hook;
+    get_index_stats_hook = planfixIndexStatsHook;
+  }
+  if (set_rel_pathlist_hook != planfixPathlistHook) {
+    oldPathlistHook = set_rel_pathlist_hook;
+    set_rel_pathlist_hook = planfixPathlistHook;
+  }
+  if (set_join_pathlist_hook != planfixJoinPathlistHook) {
+    oldJoinPathlistHook = set_join_pathlist_hook;
+    set_join_pathlist_hook = planfixJoinPathlistHook;
+  }
+  if (join_search_hook != planfixJoinSearchHook) {
+    oldJoinSearchHook = join_search_hook;
+    join_search_hook = planfixJoinSearchHook;
+  }
 
 }
 